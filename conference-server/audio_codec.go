@@ -0,0 +1,74 @@
+package main
+
+import (
+	pb "conference-server/conference"
+)
+
+// --- Audio codec negotiation ---
+//
+// Clients list the codecs they support in the JOIN command. A room sends Opus
+// only while every participant can decode it and the room is relaying; the
+// mixer works on raw samples, so mix mode always uses PCM16. Whenever the
+// room's codec changes, an AUDIO_CODEC command tells everyone what to send.
+// Receivers decode each chunk according to its own codec field, so chunks
+// already in flight during a switch still play.
+
+func supportsOpus(codecs []pb.AudioCodec) bool {
+	for _, c := range codecs {
+		if c == pb.AudioCodec_AUDIO_CODEC_OPUS {
+			return true
+		}
+	}
+	return false
+}
+
+func audioCodecName(c pb.AudioCodec) string {
+	if c == pb.AudioCodec_AUDIO_CODEC_OPUS {
+		return "opus"
+	}
+	return "pcm16"
+}
+
+// AudioCodec returns the codec participants should currently send.
+func (r *Room) AudioCodec() pb.AudioCodec {
+	r.audioMu.Lock()
+	defer r.audioMu.Unlock()
+	return r.codec
+}
+
+// negotiateAudioCodec picks the best codec every participant supports.
+func (r *Room) negotiateAudioCodec() pb.AudioCodec {
+	if r.activeMixer() != nil {
+		return pb.AudioCodec_AUDIO_CODEC_PCM16
+	}
+	subs := r.clients.snapshot().all
+	if len(subs) == 0 {
+		return pb.AudioCodec_AUDIO_CODEC_PCM16
+	}
+	for _, c := range subs {
+		if !c.opus {
+			return pb.AudioCodec_AUDIO_CODEC_PCM16
+		}
+	}
+	return pb.AudioCodec_AUDIO_CODEC_OPUS
+}
+
+// refreshAudioCodec renegotiates after a join, leave or mode change and
+// announces the result if it changed.
+func (r *Room) refreshAudioCodec() {
+	codec := r.negotiateAudioCodec()
+	r.audioMu.Lock()
+	changed := codec != r.codec
+	r.codec = codec
+	r.audioMu.Unlock()
+	if !changed {
+		return
+	}
+	logger.Infof("Room '%s' now uses %s audio", r.id, audioCodecName(codec))
+	r.Broadcast(&pb.ConferenceData{
+		Sender: "Server", RoomId: r.id,
+		Payload: &pb.ConferenceData_Command{Command: &pb.Command{
+			Type: "AUDIO_CODEC", Value: audioCodecName(codec), AudioCodecs: []pb.AudioCodec{codec},
+		}},
+	}, nil)
+}
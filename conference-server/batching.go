@@ -0,0 +1,144 @@
+package main
+
+import (
+	"time"
+
+	"google.golang.org/protobuf/encoding/protowire"
+)
+
+// --- Frame batching ---
+//
+// A client that sets Command.batching in its JOIN gets its outbound frames
+// coalesced: the sender goroutine takes everything already queued on both
+// lanes, optionally waits up to BATCH_WINDOW_MS after the first frame for
+// more, and writes them as a single ConferenceData carrying a ConferenceBatch.
+// That is one gRPC message and one HTTP/2 DATA frame instead of one per
+// frame. The batch is built from the frames' existing encodings: an embedded
+// message is its bytes behind a tag and a length, so nothing is re-marshalled.
+//
+// With the default window of 0 no delay is added; only frames that piled up
+// while the previous write was in flight are combined, which is exactly when
+// a client is falling behind. A window of 5-10 ms trades that much latency
+// for fewer writes even when the client keeps up.
+//
+// Clients may batch the other way as well; the receive loop unpacks batches
+// from anyone, and JoinConference takes the JOIN from the front of a batch
+// that arrives first.
+
+const (
+	batchField    protowire.Number = 12 // ConferenceData.batch
+	batchMessages protowire.Number = 1  // ConferenceBatch.messages
+	// batchMaxFrames caps how many frames one write carries.
+	batchMaxFrames = 64
+)
+
+var (
+	batchWindow   = time.Duration(envInt("BATCH_WINDOW_MS", 0)) * time.Millisecond
+	batchMaxBytes = envInt("BATCH_MAX_BYTES", 64<<10)
+)
+
+// outBatch collects the frames of one batched write.
+type outBatch struct {
+	frames []*frame
+	size   int
+}
+
+func (b *outBatch) add(f *frame) {
+	b.frames = append(b.frames, f)
+	b.size += len(f.data)
+}
+
+func (b *outBatch) full() bool {
+	return len(b.frames) >= batchMaxFrames || b.size >= batchMaxBytes
+}
+
+// takeQueued moves whatever is already waiting on c's lanes into b.
+func (b *outBatch) takeQueued(c *Client) {
+	for !b.full() {
+		select {
+		case f := <-c.ch:
+			b.add(f)
+			continue
+		default:
+		}
+		f := c.audio.pop()
+		if f == nil {
+			return
+		}
+		b.add(f)
+	}
+}
+
+// batchLoop is sendLoop for clients that accept batches.
+func (c *Client) batchLoop() {
+	var b outBatch
+	// go.mod targets Go 1.23, where Stop and Reset never leave a stale tick
+	// on the channel, so the timer is reused without draining.
+	window := time.NewTimer(time.Hour)
+	window.Stop()
+	defer window.Stop()
+	for {
+		select {
+		case <-c.done:
+			return
+		case f := <-c.ch:
+			b.add(f)
+		case <-c.audio.ready:
+		}
+		b.takeQueued(c)
+		if batchWindow > 0 && !b.full() {
+			window.Reset(batchWindow)
+		wait:
+			for !b.full() {
+				select {
+				case <-c.done:
+					return
+				case f := <-c.ch:
+					b.add(f)
+				case <-c.audio.ready:
+					b.takeQueued(c)
+				case <-window.C:
+					break wait
+				}
+			}
+			window.Stop()
+		}
+		if !c.flush(&b) || !c.reportSlow() {
+			return
+		}
+	}
+}
+
+// flush writes b's frames as one message, or as a plain frame when there is
+// only one, and empties b.
+func (c *Client) flush(b *outBatch) bool {
+	frames := b.frames
+	defer func() {
+		clear(b.frames)
+		b.frames, b.size = b.frames[:0], 0
+	}()
+	switch len(frames) {
+	case 0:
+		// A stale audio wakeup after takeQueued already emptied the ring.
+		return true
+	case 1:
+		return c.send(frames[0])
+	}
+	now := time.Now()
+	inner := 0
+	for i, f := range frames {
+		if f.traced {
+			frames[i] = stampSent(f, now)
+		}
+		inner += protowire.SizeTag(batchMessages) + protowire.SizeBytes(len(frames[i].data))
+	}
+	data := make([]byte, 0, protowire.SizeTag(batchField)+protowire.SizeBytes(inner))
+	data = protowire.AppendTag(data, batchField, protowire.BytesType)
+	data = protowire.AppendVarint(data, uint64(inner))
+	for _, f := range frames {
+		data = protowire.AppendTag(data, batchMessages, protowire.BytesType)
+		data = protowire.AppendBytes(data, f.data)
+	}
+	metrics.batchedOut.add(uint64(len(frames)))
+	return c.write(&frame{data: data, kind: kindBatch})
+}
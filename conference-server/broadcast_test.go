@@ -0,0 +1,152 @@
+package main
+
+import (
+	"fmt"
+	"testing"
+
+	"google.golang.org/protobuf/proto"
+
+	pb "conference-server/conference"
+)
+
+// Micro-benchmarks for Room.Broadcast and the paths that feed it. Each
+// recipient's lanes are drained by its own goroutine, as the per-client
+// sendLoop would, so the numbers include channel hand-off but not gRPC. All
+// of them report allocs/op. Run with `make bench`.
+
+func benchRoom(b *testing.B, members int) (*Room, []*Client) {
+	room := NewRoom("bench")
+	clients := make([]*Client, members)
+	for i := range clients {
+		c := &Client{
+			id:    fmt.Sprintf("user-%d", i),
+			ch:    make(chan *frame, reliableLaneSize),
+			audio: newAudioRing(),
+			done:  make(chan struct{}),
+		}
+		if err := room.AddClient(c); err != nil {
+			b.Fatal(err)
+		}
+		c.announced.Store(true)
+		go func() {
+			for {
+				select {
+				case <-c.ch:
+				case <-c.audio.ready:
+					for c.audio.pop() != nil {
+					}
+				case <-c.done:
+					return
+				}
+			}
+		}()
+		clients[i] = c
+	}
+	b.Cleanup(func() {
+		for _, c := range clients {
+			close(c.done)
+		}
+	})
+	return room, clients
+}
+
+func benchmarkBroadcast(b *testing.B, msg *pb.ConferenceData) {
+	for _, members := range benchMembers {
+		b.Run(fmt.Sprintf("members=%d", members), func(b *testing.B) {
+			room, clients := benchRoom(b, members)
+			b.ReportAllocs()
+			b.ResetTimer()
+			for i := 0; i < b.N; i++ {
+				room.Broadcast(msg, clients[0])
+			}
+			b.StopTimer()
+			b.ReportMetric(float64(b.Elapsed().Nanoseconds())/float64(b.N*(members-1)), "ns/recipient")
+		})
+	}
+}
+
+func BenchmarkBroadcastChat(b *testing.B) {
+	benchmarkBroadcast(b, &pb.ConferenceData{
+		Header: &pb.FrameHeader{ParticipantId: 1},
+		Payload: &pb.ConferenceData_TextMessage{TextMessage: &pb.ChatMessage{
+			Content: "hello, room", Timestamp: 1700000000,
+		}},
+	})
+}
+
+func BenchmarkBroadcastAudio(b *testing.B) {
+	benchmarkBroadcast(b, &pb.ConferenceData{
+		Header: &pb.FrameHeader{ParticipantId: 1, Seq: 1, TsUs: 1700000000000000},
+		Payload: &pb.ConferenceData_AudioChunk{AudioChunk: &pb.AudioChunk{
+			Data: make([]byte, mixFrameSamples*2), Codec: pb.AudioCodec_AUDIO_CODEC_PCM16, FrameDurationMs: mixFrameMs,
+		}},
+	})
+}
+
+var benchMembers = []int{2, 10, 100, 1000}
+
+// BenchmarkReceiveAudio covers a relayed audio frame end to end on the
+// server: decoded into a reused envelope, as receive does, then handled.
+func BenchmarkReceiveAudio(b *testing.B) {
+	data, err := proto.Marshal(&pb.ConferenceData{
+		Header: &pb.FrameHeader{Seq: 1, TsUs: 1700000000000000},
+		Payload: &pb.ConferenceData_AudioChunk{AudioChunk: &pb.AudioChunk{
+			Data: make([]byte, mixFrameSamples*2), Codec: pb.AudioCodec_AUDIO_CODEC_PCM16, FrameDurationMs: mixFrameMs,
+		}},
+	})
+	if err != nil {
+		b.Fatal(err)
+	}
+	s := &server{}
+	for _, members := range benchMembers {
+		b.Run(fmt.Sprintf("members=%d", members), func(b *testing.B) {
+			room, clients := benchRoom(b, members)
+			msg := new(pb.ConferenceData)
+			b.ReportAllocs()
+			b.ResetTimer()
+			for i := 0; i < b.N; i++ {
+				if err := (frameCodec{}).Unmarshal(data, msg); err != nil {
+					b.Fatal(err)
+				}
+				s.handleMessage(room, clients[0], msg)
+			}
+		})
+	}
+}
+
+func BenchmarkPrivateMessage(b *testing.B) {
+	s := &server{}
+	room, clients := benchRoom(b, 2)
+	pm := &pb.PrivateMessage{RecipientId: clients[1].id, Content: "hello, you"}
+	b.ReportAllocs()
+	b.ResetTimer()
+	for i := 0; i < b.N; i++ {
+		s.handlePrivateMessage(room, clients[0], pm)
+	}
+}
+
+// BenchmarkMixerTick mixes one frame for a room where three people talk.
+func BenchmarkMixerTick(b *testing.B) {
+	for _, members := range benchMembers {
+		b.Run(fmt.Sprintf("members=%d", members), func(b *testing.B) {
+			room, clients := benchRoom(b, members)
+			m := newMixer(room)
+			m.close() // ticks are driven by hand below
+			speakers := clients[:min(3, members)]
+			pcm := make([]byte, mixFrameSamples*2)
+			for _, c := range speakers {
+				for n := 0; n < mixPrefill; n += mixFrameSamples {
+					m.push(c, pcm)
+				}
+			}
+			b.ReportAllocs()
+			b.ResetTimer()
+			for i := 0; i < b.N; i++ {
+				for _, c := range speakers {
+					m.push(c, pcm)
+				}
+				m.tick()
+			}
+		})
+	}
+}
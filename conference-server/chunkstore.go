@@ -0,0 +1,322 @@
+package main
+
+import (
+	"crypto/sha256"
+	"encoding/hex"
+	"errors"
+	"fmt"
+	"io/fs"
+	"os"
+	"path/filepath"
+	"sync"
+	"time"
+
+	pb "conference-server/conference"
+)
+
+// --- Content-addressed chunk store ---
+//
+// Every chunk received by TransferFile is written to disk under its SHA-256
+// before it is relayed, and each transfer keeps the list of chunk hashes it
+// consists of, indexed by chunk_number. That turns a transfer from a live
+// pipe into a log:
+//   - a receiver can (re)connect at any time and read from any chunk_number,
+//     including after the sender has gone;
+//   - a sender that reconnects is told the next chunk_number the server
+//     expects and continues from there;
+//   - identical chunks, e.g. the same file uploaded twice, are stored once.
+//
+// Transfers expire CHUNK_STORE_TTL after their last activity (default 24h);
+// chunks no longer referenced by any transfer are then deleted. Chunks left
+// by a previous run are swept on start-up once they are older than the TTL.
+//
+// Configuration (environment):
+//   CHUNK_STORE_DIR  directory for chunk files (default: <tmp>/conference-chunks)
+//   CHUNK_STORE_TTL  transfer retention, as a Go duration (default: 24h)
+
+type chunkHash [sha256.Size]byte
+
+// maxChunksAhead bounds how far past the contiguous prefix a chunk may land
+// (64 GB at 64 KB chunks), so a bogus chunk_number cannot grow a log without
+// limit.
+const maxChunksAhead = 1 << 20
+
+var errChunkRange = errors.New("chunk number out of range")
+
+type storedChunk struct {
+	hash        chunkHash
+	offset      int64 // byte offset of the chunk in the file
+	compression pb.FileCompression
+	rawSize     int32 // size before compression
+	stored      bool
+}
+
+// transferLog lists the chunks of one transfer by chunk_number. Ranges of a
+// parallel upload arrive independently, so the log may have holes; the
+// contiguous prefix is tracked separately.
+type transferLog struct {
+	mu         sync.Mutex
+	chunks     []storedChunk
+	contiguous int32         // chunks [0, contiguous) are all stored
+	last       int32         // chunk_number of the is_last chunk, -1 until it arrives
+	changed    chan struct{} // closed and replaced whenever the log grows
+	lastUsed   time.Time
+}
+
+// next returns the first chunk number missing from the log.
+func (l *transferLog) next() int32 {
+	l.mu.Lock()
+	defer l.mu.Unlock()
+	return l.contiguous
+}
+
+// firstMissing returns the first chunk number in [from, end) that is not
+// stored yet, or end if there is none.
+func (l *transferLog) firstMissing(from, end int32) int32 {
+	l.mu.Lock()
+	defer l.mu.Unlock()
+	n := max(from, l.contiguous)
+	for n < end && int(n) < len(l.chunks) && l.chunks[n].stored {
+		n++
+	}
+	return min(n, end)
+}
+
+// state reports whether chunk n is stored, whether the transfer ends before
+// n, and returns a channel closed on the next change.
+func (l *transferLog) state(n int32) (stored, beyondEnd bool, changed <-chan struct{}) {
+	l.mu.Lock()
+	defer l.mu.Unlock()
+	stored = int(n) < len(l.chunks) && l.chunks[n].stored
+	beyondEnd = l.last >= 0 && n > l.last
+	return stored, beyondEnd, l.changed
+}
+
+type chunkStore struct {
+	dir      string
+	ttl      time.Duration
+	onExpire func(transferID string)
+
+	mu   sync.Mutex
+	logs map[string]*transferLog
+	refs map[chunkHash]int
+}
+
+func newChunkStore(dir string, ttl time.Duration) (*chunkStore, error) {
+	if err := os.MkdirAll(dir, 0o755); err != nil {
+		return nil, err
+	}
+	s := &chunkStore{
+		dir:  dir,
+		ttl:  ttl,
+		logs: make(map[string]*transferLog),
+		refs: make(map[chunkHash]int),
+	}
+	s.sweep()
+	go s.janitor()
+	return s, nil
+}
+
+// chunkStoreConfig reads CHUNK_STORE_DIR and CHUNK_STORE_TTL.
+func chunkStoreConfig() (string, time.Duration) {
+	dir := os.Getenv("CHUNK_STORE_DIR")
+	if dir == "" {
+		dir = filepath.Join(os.TempDir(), "conference-chunks")
+	}
+	ttl := 24 * time.Hour
+	if v := os.Getenv("CHUNK_STORE_TTL"); v != "" {
+		if d, err := time.ParseDuration(v); err == nil && d > 0 {
+			ttl = d
+		} else {
+			logger.Warnf("Invalid CHUNK_STORE_TTL %q, using %v", v, ttl)
+		}
+	}
+	return dir, ttl
+}
+
+func (s *chunkStore) path(h chunkHash) string {
+	name := hex.EncodeToString(h[:])
+	return filepath.Join(s.dir, name[:2], name)
+}
+
+// open returns the log of a transfer, creating it if needed.
+func (s *chunkStore) open(transferID string) *transferLog {
+	s.mu.Lock()
+	defer s.mu.Unlock()
+	l, ok := s.logs[transferID]
+	if !ok {
+		l = &transferLog{last: -1, changed: make(chan struct{})}
+		s.logs[transferID] = l
+	}
+	l.mu.Lock()
+	l.lastUsed = time.Now()
+	l.mu.Unlock()
+	return l
+}
+
+// append stores a chunk of a transfer, as sent: compressed chunks stay
+// compressed. Chunks the log already has are ignored, so a resuming sender
+// may overlap what was stored. It reports whether the chunk was new.
+func (s *chunkStore) append(l *transferLog, chunk *pb.FileChunk) (bool, error) {
+	n, data := chunk.GetChunkNumber(), chunk.GetData()
+	l.mu.Lock()
+	if n < 0 || n >= l.contiguous+maxChunksAhead {
+		l.mu.Unlock()
+		return false, fmt.Errorf("%w: %d", errChunkRange, n)
+	}
+	if int(n) < len(l.chunks) && l.chunks[n].stored {
+		l.mu.Unlock()
+		return false, nil
+	}
+	l.mu.Unlock()
+
+	h := chunkHash(sha256.Sum256(data))
+	// Take the reference first so expire cannot delete a file being reused.
+	s.mu.Lock()
+	s.refs[h]++
+	s.mu.Unlock()
+	if err := s.write(h, data); err != nil {
+		s.release(h)
+		return false, err
+	}
+
+	l.mu.Lock()
+	if int(n) >= len(l.chunks) {
+		l.chunks = append(l.chunks, make([]storedChunk, int(n)+1-len(l.chunks))...)
+	}
+	if l.chunks[n].stored {
+		// Another stream stored the same chunk meanwhile. Unlock first:
+		// expire takes the store lock before the log's.
+		l.mu.Unlock()
+		s.release(h)
+		return false, nil
+	}
+	defer l.mu.Unlock()
+	l.chunks[n] = storedChunk{
+		hash: h, offset: chunk.GetOffset(), compression: chunk.GetCompression(), rawSize: chunk.GetRawSize(), stored: true,
+	}
+	for int(l.contiguous) < len(l.chunks) && l.chunks[l.contiguous].stored {
+		l.contiguous++
+	}
+	if chunk.GetIsLast() {
+		l.last = n
+	}
+	l.lastUsed = time.Now()
+	close(l.changed)
+	l.changed = make(chan struct{})
+	return true, nil
+}
+
+// release drops one reference to a chunk, deleting it when unused.
+func (s *chunkStore) release(h chunkHash) {
+	s.mu.Lock()
+	defer s.mu.Unlock()
+	if s.refs[h]--; s.refs[h] <= 0 {
+		delete(s.refs, h)
+		os.Remove(s.path(h))
+	}
+}
+
+// write persists a chunk unless a chunk with the same content exists.
+func (s *chunkStore) write(h chunkHash, data []byte) error {
+	path := s.path(h)
+	if _, err := os.Stat(path); err == nil {
+		now := time.Now()
+		os.Chtimes(path, now, now) // keep it clear of the start-up sweep
+		return nil
+	}
+	if err := os.MkdirAll(filepath.Dir(path), 0o755); err != nil {
+		return err
+	}
+	tmp, err := os.CreateTemp(filepath.Dir(path), ".chunk-*")
+	if err != nil {
+		return err
+	}
+	if _, err := tmp.Write(data); err != nil {
+		tmp.Close()
+		os.Remove(tmp.Name())
+		return err
+	}
+	if err := tmp.Close(); err != nil {
+		os.Remove(tmp.Name())
+		return err
+	}
+	// Rename is atomic, so readers never see a partially written chunk.
+	return os.Rename(tmp.Name(), path)
+}
+
+// read returns chunk n of a transfer as it was sent, without the transfer
+// ID.
+func (s *chunkStore) read(l *transferLog, n int32) (*pb.FileChunk, error) {
+	l.mu.Lock()
+	if n < 0 || int(n) >= len(l.chunks) || !l.chunks[n].stored {
+		l.mu.Unlock()
+		return nil, fmt.Errorf("chunk %d not stored", n)
+	}
+	c := l.chunks[n]
+	last := n == l.last
+	l.lastUsed = time.Now()
+	l.mu.Unlock()
+	data, err := os.ReadFile(s.path(c.hash))
+	if err != nil {
+		return nil, err
+	}
+	return &pb.FileChunk{
+		Data: data, ChunkNumber: n, IsLast: last, Offset: c.offset, Compression: c.compression, RawSize: c.rawSize,
+	}, nil
+}
+
+// janitor expires idle transfers and deletes chunks nobody references.
+func (s *chunkStore) janitor() {
+	ticker := time.NewTicker(max(s.ttl/4, time.Minute))
+	defer ticker.Stop()
+	for range ticker.C {
+		s.expire(time.Now().Add(-s.ttl))
+	}
+}
+
+func (s *chunkStore) expire(cutoff time.Time) {
+	var expired []string
+	s.mu.Lock()
+	for id, l := range s.logs {
+		l.mu.Lock()
+		idle := l.lastUsed.Before(cutoff)
+		chunks := l.chunks
+		l.mu.Unlock()
+		if !idle {
+			continue
+		}
+		delete(s.logs, id)
+		expired = append(expired, id)
+		for _, c := range chunks {
+			if !c.stored {
+				continue
+			}
+			if s.refs[c.hash]--; s.refs[c.hash] <= 0 {
+				delete(s.refs, c.hash)
+				os.Remove(s.path(c.hash))
+			}
+		}
+	}
+	s.mu.Unlock()
+	for _, id := range expired {
+		logger.Debugf("Transfer %s expired from the chunk store", id)
+		if s.onExpire != nil {
+			s.onExpire(id)
+		}
+	}
+}
+
+// sweep removes chunk files from earlier runs that are older than the TTL.
+func (s *chunkStore) sweep() {
+	cutoff := time.Now().Add(-s.ttl)
+	filepath.WalkDir(s.dir, func(path string, d fs.DirEntry, err error) error {
+		if err != nil || d.IsDir() {
+			return nil
+		}
+		if info, err := d.Info(); err == nil && info.ModTime().Before(cutoff) {
+			os.Remove(path)
+		}
+		return nil
+	})
+}
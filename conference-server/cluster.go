@@ -0,0 +1,331 @@
+package main
+
+import (
+	"context"
+	"crypto/hmac"
+	"crypto/sha256"
+	"encoding/base64"
+	"errors"
+	"fmt"
+	"hash/fnv"
+	"io"
+	"os"
+	"sort"
+	"strconv"
+	"strings"
+	"sync"
+	"time"
+
+	"google.golang.org/grpc"
+	"google.golang.org/grpc/credentials/insecure"
+	"google.golang.org/grpc/metadata"
+	"google.golang.org/grpc/peer"
+
+	pb "conference-server/conference"
+)
+
+// --- Clustering ---
+//
+// With CLUSTER_NODES set, several conference-server processes share the
+// rooms: each room belongs to one node, picked by consistent hashing of its
+// ID, and a room's state (members, mixer, transfers) lives only there. A
+// node that receives a call for a room it does not own proxies it to the
+// owner over a gRPC mesh: JoinConference and TransferFile streams are spliced
+// message by message and the unary calls are forwarded. The owner then fans
+// out to every member as usual, whichever node they connected to.
+//
+// Proxied calls carry the forwarding node's ID, so the owner serves them
+// locally instead of proxying again, and the client's address, so logs show
+// the real peer. Both are signed with CLUSTER_SECRET, which every node must
+// share; on calls without a valid signature the interceptors strip them, so
+// a client cannot pose as a node to reach a room on a node that does not own
+// it.
+
+const (
+	// Ring points per node; enough for an even spread over a handful of nodes.
+	clusterVirtualNodes = 128
+
+	clusterNodeKey    = "cluster-node"
+	forwardedForKey   = "x-forwarded-for"
+	clusterAuthKey    = "cluster-auth" // "<unix seconds>.<HMAC of node, address and time>"
+	transferRoomIDKey = "room-id"
+
+	// How far a signed call's time may be from ours before it is refused.
+	clusterAuthSkew = 2 * time.Minute
+)
+
+type ringPoint struct {
+	hash uint64
+	node *clusterNode
+}
+
+type clusterNode struct {
+	id   string
+	addr string
+
+	once   sync.Once
+	client pb.ConferenceServiceClient
+	err    error
+}
+
+// conn dials the node on first use; gRPC reconnects by itself afterwards.
+func (n *clusterNode) conn() (pb.ConferenceServiceClient, error) {
+	n.once.Do(func() {
+		cc, err := grpc.NewClient(n.addr, grpc.WithTransportCredentials(insecure.NewCredentials()))
+		if err != nil {
+			n.err = fmt.Errorf("dialing node %s at %s: %w", n.id, n.addr, err)
+			return
+		}
+		n.client = pb.NewConferenceServiceClient(cc)
+	})
+	return n.client, n.err
+}
+
+// cluster is nil when the server runs standalone; every method accepts a nil
+// receiver and then routes everything locally.
+type cluster struct {
+	self   string
+	secret []byte
+	nodes  map[string]*clusterNode
+	ring   []ringPoint // sorted by hash
+}
+
+// clusterFromEnv parses CLUSTER_NODES ("id=host:port,..."), NODE_ID and
+// CLUSTER_SECRET.
+func clusterFromEnv() (*cluster, error) {
+	spec := strings.TrimSpace(os.Getenv("CLUSTER_NODES"))
+	if spec == "" {
+		return nil, nil
+	}
+	secret := os.Getenv("CLUSTER_SECRET")
+	if secret == "" {
+		return nil, errors.New("CLUSTER_SECRET must be set along with CLUSTER_NODES")
+	}
+	c := &cluster{self: os.Getenv("NODE_ID"), secret: []byte(secret), nodes: make(map[string]*clusterNode)}
+	for _, entry := range strings.Split(spec, ",") {
+		id, addr, ok := strings.Cut(strings.TrimSpace(entry), "=")
+		if !ok || id == "" || addr == "" {
+			return nil, fmt.Errorf("CLUSTER_NODES: bad entry %q (want id=host:port)", entry)
+		}
+		if _, dup := c.nodes[id]; dup {
+			return nil, fmt.Errorf("CLUSTER_NODES: node %q listed twice", id)
+		}
+		n := &clusterNode{id: id, addr: addr}
+		c.nodes[id] = n
+		for i := 0; i < clusterVirtualNodes; i++ {
+			c.ring = append(c.ring, ringPoint{hash: ringHash(fmt.Sprintf("%s#%d", id, i)), node: n})
+		}
+	}
+	if _, ok := c.nodes[c.self]; !ok {
+		return nil, fmt.Errorf("NODE_ID %q is not in CLUSTER_NODES", c.self)
+	}
+	sort.Slice(c.ring, func(i, j int) bool { return c.ring[i].hash < c.ring[j].hash })
+	return c, nil
+}
+
+func ringHash(key string) uint64 {
+	h := fnv.New64a()
+	h.Write([]byte(key))
+	return h.Sum64()
+}
+
+// owner returns the node that owns a room: the first ring point at or after
+// the room's hash, wrapping around.
+func (c *cluster) owner(roomID string) *clusterNode {
+	h := ringHash(roomID)
+	i := sort.Search(len(c.ring), func(i int) bool { return c.ring[i].hash >= h })
+	if i == len(c.ring) {
+		i = 0
+	}
+	return c.ring[i].node
+}
+
+// forwarded reports whether the call was proxied here by another node. Only
+// calls that passed verifyMesh still carry the node's ID.
+func (c *cluster) forwarded(ctx context.Context) bool {
+	if c == nil {
+		return false
+	}
+	md, _ := metadata.FromIncomingContext(ctx)
+	_, ok := c.nodes[firstValue(md, clusterNodeKey)]
+	return ok
+}
+
+// route returns the owning node for a call about roomID, or nil if this node
+// should serve it.
+func (c *cluster) route(ctx context.Context, roomID string) *clusterNode {
+	if c == nil || roomID == "" || c.forwarded(ctx) {
+		return nil
+	}
+	if n := c.owner(roomID); n.id != c.self {
+		return n
+	}
+	return nil
+}
+
+// outgoing prepares the context for a proxied call: the client's metadata,
+// plus this node's ID and the client's address, signed.
+func (c *cluster) outgoing(ctx context.Context) context.Context {
+	md, _ := metadata.FromIncomingContext(ctx)
+	md = md.Copy()
+	addr := c.clientAddr(ctx)
+	ts := strconv.FormatInt(time.Now().Unix(), 10)
+	md.Set(clusterNodeKey, c.self)
+	md.Set(forwardedForKey, addr)
+	md.Set(clusterAuthKey, ts+"."+c.meshMAC(c.self, addr, ts))
+	return metadata.NewOutgoingContext(ctx, md)
+}
+
+func (c *cluster) meshMAC(node, addr, ts string) string {
+	mac := hmac.New(sha256.New, c.secret)
+	mac.Write([]byte(node + "\x00" + addr + "\x00" + ts))
+	return base64.RawURLEncoding.EncodeToString(mac.Sum(nil))
+}
+
+// authentic reports whether md was signed by a node of this cluster.
+func (c *cluster) authentic(md metadata.MD) bool {
+	if c == nil {
+		return false
+	}
+	node := firstValue(md, clusterNodeKey)
+	if _, ok := c.nodes[node]; !ok {
+		return false
+	}
+	ts, mac, ok := strings.Cut(firstValue(md, clusterAuthKey), ".")
+	if !ok {
+		return false
+	}
+	unix, err := strconv.ParseInt(ts, 10, 64)
+	if err != nil {
+		return false
+	}
+	if skew := time.Since(time.Unix(unix, 0)); skew > clusterAuthSkew || skew < -clusterAuthSkew {
+		return false
+	}
+	return hmac.Equal([]byte(mac), []byte(c.meshMAC(node, firstValue(md, forwardedForKey), ts)))
+}
+
+// verifyMesh returns ctx without the mesh metadata unless another node
+// signed it.
+func (c *cluster) verifyMesh(ctx context.Context) context.Context {
+	md, _ := metadata.FromIncomingContext(ctx)
+	if len(md.Get(clusterNodeKey))+len(md.Get(forwardedForKey))+len(md.Get(clusterAuthKey)) == 0 || c.authentic(md) {
+		return ctx
+	}
+	md = md.Copy()
+	md.Delete(clusterNodeKey)
+	md.Delete(forwardedForKey)
+	md.Delete(clusterAuthKey)
+	return metadata.NewIncomingContext(ctx, md)
+}
+
+func (c *cluster) unaryMesh(ctx context.Context, req any, info *grpc.UnaryServerInfo, handler grpc.UnaryHandler) (any, error) {
+	return handler(c.verifyMesh(ctx), req)
+}
+
+func (c *cluster) streamMesh(srv any, ss grpc.ServerStream, info *grpc.StreamServerInfo, handler grpc.StreamHandler) error {
+	if ctx := c.verifyMesh(ss.Context()); ctx != ss.Context() {
+		ss = meshStream{ss, ctx}
+	}
+	return handler(srv, ss)
+}
+
+// meshStream is a stream whose mesh metadata was stripped.
+type meshStream struct {
+	grpc.ServerStream
+	ctx context.Context
+}
+
+func (s meshStream) Context() context.Context { return s.ctx }
+
+// clientAddr is the caller's address, or the original client's for calls
+// proxied by another node.
+func (c *cluster) clientAddr(ctx context.Context) string {
+	if c.forwarded(ctx) {
+		md, _ := metadata.FromIncomingContext(ctx)
+		if addr := firstValue(md, forwardedForKey); addr != "" {
+			return addr
+		}
+	}
+	if p, ok := peer.FromContext(ctx); ok {
+		return p.Addr.String()
+	}
+	return ""
+}
+
+// --- Proxied streams ---
+
+type msgStream[T any] interface {
+	Send(*T) error
+	Recv() (*T, error)
+}
+
+// splice copies messages both ways between a client's stream and the owning
+// node's until either side finishes. first, if not nil, has already been read
+// from the client and goes upstream before anything else.
+func splice[T any](ctx context.Context, down msgStream[T], open func(context.Context) (grpc.BidiStreamingClient[T, T], error), first *T) error {
+	ctx, cancel := context.WithCancel(ctx)
+	defer cancel()
+	up, err := open(ctx)
+	if err != nil {
+		return err
+	}
+	if first != nil {
+		if err := up.Send(first); err != nil {
+			return err
+		}
+	}
+	go func() {
+		for {
+			m, err := down.Recv()
+			if err == io.EOF {
+				up.CloseSend()
+				return
+			}
+			if err != nil {
+				cancel()
+				return
+			}
+			// A failed send ends the upstream call; Recv below reports why.
+			if up.Send(m) != nil {
+				return
+			}
+		}
+	}()
+	for {
+		m, err := up.Recv()
+		if err == io.EOF {
+			return nil
+		}
+		if err != nil {
+			return err
+		}
+		if err := down.Send(m); err != nil {
+			return err
+		}
+	}
+}
+
+// proxyJoin splices a JoinConference stream to the owner of the room. first
+// is the client's first message as it arrived, join the JOIN it carries (the
+// same message unless the JOIN came batched).
+func (c *cluster) proxyJoin(n *clusterNode, stream pb.ConferenceService_JoinConferenceServer, first, join *pb.ConferenceData) error {
+	client, err := n.conn()
+	if err != nil {
+		return err
+	}
+	logger.Infof("Proxying '%s' (%s) to node %s for room '%s'", join.GetSender(), c.clientAddr(stream.Context()), n.id, join.GetRoomId())
+	return splice(c.outgoing(stream.Context()), stream, func(ctx context.Context) (grpc.BidiStreamingClient[pb.ConferenceData, pb.ConferenceData], error) {
+		return client.JoinConference(ctx)
+	}, first)
+}
+
+func (c *cluster) proxyTransfer(n *clusterNode, stream pb.ConferenceService_TransferFileServer) error {
+	client, err := n.conn()
+	if err != nil {
+		return err
+	}
+	return splice(c.outgoing(stream.Context()), stream, func(ctx context.Context) (grpc.BidiStreamingClient[pb.FileChunk, pb.FileChunk], error) {
+		return client.TransferFile(ctx)
+	}, nil)
+}
@@ -0,0 +1,393 @@
+// Command loadgen opens many JoinConference streams against a running
+// conference-server and reports delivery latency, losses and, when the
+// server exposes DEBUG_ADDR, its CPU time and allocations per message.
+//
+//	go run ./cmd/loadgen -clients 1000 -rooms 20 -duration 30s -debug http://localhost:6060
+//
+// Every client sends chat at -chat-interval (exponentially distributed) and
+// the first -talkers clients of each room stream 20 ms PCM frames. Messages
+// carry their send time, so latency is measured end to end on one clock.
+// Lost deliveries are what the server dropped on its "channel full" and
+// audio-lane paths, plus anything still queued when the run ends. With
+// -batch the clients accept ConferenceBatch, so the report also shows how
+// many deliveries each received gRPC message carried on average.
+package main
+
+import (
+	"context"
+	"encoding/binary"
+	"encoding/json"
+	"flag"
+	"fmt"
+	"log"
+	"math"
+	"math/bits"
+	"math/rand"
+	"net/http"
+	"os"
+	"strconv"
+	"strings"
+	"sync"
+	"sync/atomic"
+	"time"
+
+	"google.golang.org/grpc"
+	"google.golang.org/grpc/codes"
+	"google.golang.org/grpc/credentials/insecure"
+	"google.golang.org/grpc/status"
+
+	pb "conference-server/conference"
+)
+
+const chatPrefix = "loadgen "
+
+var (
+	addr         = flag.String("addr", "localhost:50051", "server address")
+	numClients   = flag.Int("clients", 1000, "JoinConference streams to open")
+	numRooms     = flag.Int("rooms", 20, "rooms to spread the clients over")
+	numConns     = flag.Int("conns", 16, "gRPC connections the streams are multiplexed over")
+	duration     = flag.Duration("duration", 30*time.Second, "measurement time after every client joined")
+	chatInterval = flag.Duration("chat-interval", 5*time.Second, "mean time between chat messages per client (0 disables chat)")
+	talkers      = flag.Int("talkers", 2, "clients per room streaming audio")
+	frameMs      = flag.Int("frame-ms", 20, "audio frame duration")
+	debugURL     = flag.String("debug", "", "server debug endpoint (DEBUG_ADDR), e.g. http://localhost:6060")
+	batch        = flag.Bool("batch", false, "accept batched frames from the server (Command.batching)")
+)
+
+// --- Latency histogram ---
+
+// histogram counts latencies in log-linear microsecond buckets: 16 per power
+// of two, so a reported quantile is within about 6% of the true value.
+type histogram struct {
+	counts [1024]atomic.Uint64
+}
+
+func bucketOf(us uint64) int {
+	if us < 16 {
+		return int(us)
+	}
+	exp := bits.Len64(us) - 1
+	return (exp-3)*16 + int((us>>(exp-4))&15)
+}
+
+func bucketValue(i int) time.Duration {
+	if i < 16 {
+		return time.Duration(i) * time.Microsecond
+	}
+	exp := i/16 + 3
+	return time.Duration((16+uint64(i%16))<<(exp-4)) * time.Microsecond
+}
+
+func (h *histogram) record(d time.Duration) {
+	h.counts[bucketOf(uint64(max(d, 0)/time.Microsecond))].Add(1)
+}
+
+func (h *histogram) total() uint64 {
+	var n uint64
+	for i := range h.counts {
+		n += h.counts[i].Load()
+	}
+	return n
+}
+
+func (h *histogram) quantile(q float64) time.Duration {
+	n := h.total()
+	if n == 0 {
+		return 0
+	}
+	target := uint64(q*float64(n-1)) + 1
+	var seen uint64
+	for i := range h.counts {
+		if seen += h.counts[i].Load(); seen >= target {
+			return bucketValue(i)
+		}
+	}
+	return bucketValue(len(h.counts) - 1)
+}
+
+// --- Load ---
+
+type stats struct {
+	chat, audio         histogram
+	chatSent, audioSent atomic.Uint64
+	expectChat          atomic.Uint64 // chat deliveries the server should make
+	expectAudio         atomic.Uint64
+	streamErrors        atomic.Uint64
+	received, frames    atomic.Uint64 // gRPC messages read and the frames they carried
+}
+
+// window is the measured interval, in send-time nanoseconds. Only messages
+// sent inside it are counted, on both the sending and the receiving side, so
+// deliveries still in flight when it closes are not mistaken for losses.
+type window struct {
+	from, to atomic.Int64
+}
+
+func newWindow() *window {
+	w := &window{}
+	w.from.Store(math.MaxInt64)
+	w.to.Store(math.MaxInt64)
+	return w
+}
+
+func (w *window) contains(sentNanos int64) bool {
+	return sentNanos >= w.from.Load() && sentNanos < w.to.Load()
+}
+
+type loadClient struct {
+	id     string
+	room   string
+	talker bool
+	peers  int // other members of its room
+	stream pb.ConferenceService_JoinConferenceClient
+	window *window
+}
+
+func (c *loadClient) join(ctx context.Context, client pb.ConferenceServiceClient) error {
+	stream, err := client.JoinConference(ctx)
+	if err != nil {
+		return err
+	}
+	c.stream = stream
+	return stream.Send(&pb.ConferenceData{
+		Sender: c.id, RoomId: c.room,
+		Payload: &pb.ConferenceData_Command{Command: &pb.Command{
+			Type: "JOIN", AudioCodecs: []pb.AudioCodec{pb.AudioCodec_AUDIO_CODEC_PCM16},
+			Batching: *batch,
+		}},
+	})
+}
+
+func (c *loadClient) receive(st *stats) {
+	for {
+		msg, err := c.stream.Recv()
+		if err != nil {
+			if status.Code(err) != codes.Canceled {
+				st.streamErrors.Add(1)
+			}
+			return
+		}
+		now := time.Now()
+		st.received.Add(1)
+		if b := msg.GetBatch(); b != nil {
+			st.frames.Add(uint64(len(b.Messages)))
+			for _, m := range b.Messages {
+				c.record(st, m, now)
+			}
+			continue
+		}
+		st.frames.Add(1)
+		c.record(st, msg, now)
+	}
+}
+
+func (c *loadClient) record(st *stats, msg *pb.ConferenceData, now time.Time) {
+	switch p := msg.Payload.(type) {
+	case *pb.ConferenceData_TextMessage:
+		if ts, ok := strings.CutPrefix(p.TextMessage.Content, chatPrefix); ok {
+			if sent, err := strconv.ParseInt(ts, 10, 64); err == nil && c.window.contains(sent) {
+				st.chat.record(now.Sub(time.Unix(0, sent)))
+			}
+		}
+	case *pb.ConferenceData_AudioChunk:
+		if data := p.AudioChunk.Data; len(data) >= 8 {
+			if sent := int64(binary.LittleEndian.Uint64(data)); c.window.contains(sent) {
+				st.audio.record(now.Sub(time.Unix(0, sent)))
+			}
+		}
+	}
+}
+
+func (c *loadClient) sendChat(ctx context.Context, st *stats, mu *sync.Mutex) {
+	if *chatInterval <= 0 {
+		return
+	}
+	rng := rand.New(rand.NewSource(time.Now().UnixNano()))
+	for {
+		wait := time.Duration(rng.ExpFloat64() * float64(*chatInterval))
+		select {
+		case <-ctx.Done():
+			return
+		case <-time.After(wait):
+		}
+		sent := time.Now()
+		msg := &pb.ConferenceData{
+			Payload: &pb.ConferenceData_TextMessage{TextMessage: &pb.ChatMessage{
+				Timestamp: sent.Unix(),
+				Content:   chatPrefix + strconv.FormatInt(sent.UnixNano(), 10),
+			}},
+		}
+		mu.Lock()
+		err := c.stream.Send(msg)
+		mu.Unlock()
+		if err != nil {
+			return
+		}
+		if c.window.contains(sent.UnixNano()) {
+			st.chatSent.Add(1)
+			st.expectChat.Add(uint64(c.peers))
+		}
+	}
+}
+
+func (c *loadClient) sendAudio(ctx context.Context, st *stats, mu *sync.Mutex) {
+	if !c.talker {
+		return
+	}
+	frame := make([]byte, 48000**frameMs/1000*2)
+	ticker := time.NewTicker(time.Duration(*frameMs) * time.Millisecond)
+	defer ticker.Stop()
+	for seq := uint32(0); ; seq++ {
+		select {
+		case <-ctx.Done():
+			return
+		case <-ticker.C:
+		}
+		sent := time.Now().UnixNano()
+		binary.LittleEndian.PutUint64(frame, uint64(sent))
+		msg := &pb.ConferenceData{
+			Header: &pb.FrameHeader{Seq: seq, TsUs: sent / 1000},
+			Payload: &pb.ConferenceData_AudioChunk{AudioChunk: &pb.AudioChunk{
+				Data: frame, Codec: pb.AudioCodec_AUDIO_CODEC_PCM16,
+				FrameDurationMs: uint32(*frameMs), AudioLevel: 100,
+			}},
+		}
+		mu.Lock()
+		err := c.stream.Send(msg)
+		mu.Unlock()
+		if err != nil {
+			return
+		}
+		if c.window.contains(sent) {
+			st.audioSent.Add(1)
+			st.expectAudio.Add(uint64(c.peers))
+		}
+	}
+}
+
+// --- Server counters ---
+
+type processVars struct {
+	CPUSeconds   float64 `json:"cpu_seconds"`
+	AllocObjects float64 `json:"alloc_objects"`
+	AllocBytes   float64 `json:"alloc_bytes"`
+	Goroutines   int     `json:"goroutines"`
+}
+
+func readProcess(url string) (processVars, error) {
+	var vars struct {
+		Process processVars `json:"process"`
+	}
+	resp, err := http.Get(strings.TrimSuffix(url, "/") + "/debug/vars")
+	if err != nil {
+		return vars.Process, err
+	}
+	defer resp.Body.Close()
+	err = json.NewDecoder(resp.Body).Decode(&vars)
+	return vars.Process, err
+}
+
+func main() {
+	flag.Parse()
+	if *numRooms < 1 || *numClients < *numRooms {
+		log.Fatalf("need at least one client per room")
+	}
+
+	ctx, cancel := context.WithCancel(context.Background())
+	defer cancel()
+	conns := make([]pb.ConferenceServiceClient, *numConns)
+	for i := range conns {
+		cc, err := grpc.NewClient(*addr, grpc.WithTransportCredentials(insecure.NewCredentials()))
+		if err != nil {
+			log.Fatalf("dial %s: %v", *addr, err)
+		}
+		defer cc.Close()
+		conns[i] = pb.NewConferenceServiceClient(cc)
+	}
+
+	var st stats
+	measured := newWindow()
+	perRoom := make([]int, *numRooms)
+	for i := 0; i < *numClients; i++ {
+		perRoom[i%*numRooms]++
+	}
+	clients := make([]*loadClient, *numClients)
+	start := time.Now()
+	for i := range clients {
+		r := i % *numRooms
+		c := &loadClient{
+			id: fmt.Sprintf("loadgen-%d", i), room: fmt.Sprintf("loadgen-room-%d", r),
+			talker: i / *numRooms < *talkers, peers: perRoom[r] - 1, window: measured,
+		}
+		if err := c.join(ctx, conns[i%len(conns)]); err != nil {
+			log.Fatalf("client %d: join: %v", i, err)
+		}
+		go c.receive(&st)
+		clients[i] = c
+	}
+	log.Printf("%d clients joined %d rooms in %v", len(clients), *numRooms, time.Since(start).Round(time.Millisecond))
+
+	sendCtx, stopSending := context.WithCancel(ctx)
+	var wg sync.WaitGroup
+	for _, c := range clients {
+		mu := &sync.Mutex{} // a stream's Send is not safe for concurrent use
+		wg.Add(2)
+		go func(c *loadClient) { defer wg.Done(); c.sendChat(sendCtx, &st, mu) }(c)
+		go func(c *loadClient) { defer wg.Done(); c.sendAudio(sendCtx, &st, mu) }(c)
+	}
+
+	// Let joins and the first sends settle before measuring.
+	time.Sleep(time.Second)
+	var before processVars
+	if *debugURL != "" {
+		var err error
+		if before, err = readProcess(*debugURL); err != nil {
+			log.Printf("reading server counters: %v", err)
+			*debugURL = ""
+		}
+	}
+	measured.from.Store(time.Now().UnixNano())
+	time.Sleep(*duration)
+	measured.to.Store(time.Now().UnixNano())
+	var after processVars
+	if *debugURL != "" {
+		after, _ = readProcess(*debugURL)
+	}
+	// Give in-flight deliveries a moment before counting losses.
+	time.Sleep(time.Second)
+	stopSending()
+	wg.Wait()
+
+	report(&st, before, after)
+	if st.streamErrors.Load() > 0 {
+		os.Exit(1)
+	}
+}
+
+func report(st *stats, before, after processVars) {
+	fmt.Printf("\n%-6s %10s %12s %10s %10s %10s %10s\n", "kind", "sent", "delivered", "lost", "p50", "p99", "p999")
+	row := func(name string, sent, expect uint64, h *histogram) uint64 {
+		got := h.total()
+		lost := expect - min(got, expect)
+		fmt.Printf("%-6s %10d %12d %10d %10v %10v %10v\n", name, sent, got, lost,
+			h.quantile(0.50), h.quantile(0.99), h.quantile(0.999))
+		return got
+	}
+	chat := row("chat", st.chatSent.Load(), st.expectChat.Load(), &st.chat)
+	audio := row("audio", st.audioSent.Load(), st.expectAudio.Load(), &st.audio)
+	fmt.Printf("stream errors: %d\n", st.streamErrors.Load())
+	if n := st.received.Load(); n > 0 {
+		fmt.Printf("received: %d gRPC messages, %.2f frames each\n", n, float64(st.frames.Load())/float64(n))
+	}
+
+	sent := st.chatSent.Load() + st.audioSent.Load()
+	delivered := chat + audio
+	if after.CPUSeconds == 0 || sent == 0 || delivered == 0 {
+		return
+	}
+	cpu := after.CPUSeconds - before.CPUSeconds
+	allocs := after.AllocObjects - before.AllocObjects
+	fmt.Printf("server: %.2f CPU s, %.1f µs CPU/delivery, %.1f allocs/message, %.2f allocs/delivery, %.0f B/delivery, %d goroutines\n",
+		cpu, cpu*1e6/float64(delivered), allocs/float64(sent), allocs/float64(delivered),
+		(after.AllocBytes-before.AllocBytes)/float64(delivered), after.Goroutines)
+}
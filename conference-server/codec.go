@@ -0,0 +1,77 @@
+package main
+
+import (
+	"fmt"
+
+	"google.golang.org/protobuf/proto"
+
+	pb "conference-server/conference"
+)
+
+// --- Pre-encoded frames ---
+//
+// A broadcast is marshalled once into a frame and the same bytes are handed to
+// every recipient stream. frameCodec is installed as the server codec: it
+// passes frames through untouched and falls back to regular protobuf
+// marshalling for everything else, so handlers can keep sending plain
+// messages where fan-out does not matter.
+
+// frame is the wire encoding of a ConferenceData plus what the send path
+// needs to know about it. It is read-only once built and may be shared by
+// any number of goroutines. A frame does not keep the message it was encoded
+// from, so the receive loop can reuse its envelope once the message has been
+// handled.
+type frame struct {
+	data   []byte
+	kind   payloadKind
+	traced bool  // carries trace stamps; see withSendStamp
+	recvUs int64 // trace server_recv_us, when traced
+}
+
+func newFrame(msg *pb.ConferenceData) (*frame, error) {
+	data, err := proto.Marshal(msg)
+	if err != nil {
+		return nil, err
+	}
+	f := &frame{data: data, kind: kindOf(msg)}
+	if t := msg.GetTrace(); t != nil {
+		f.traced, f.recvUs = true, t.GetServerRecvUs()
+	}
+	return f, nil
+}
+
+// serverFrame encodes a server-generated message. These are built from
+// well-formed literals, so an encoding error is a programming error.
+func serverFrame(msg *pb.ConferenceData) *frame {
+	f, err := newFrame(msg)
+	if err != nil {
+		panic(fmt.Sprintf("encoding server message: %v", err))
+	}
+	return f
+}
+
+// frameCodec replaces the default "proto" codec on the server.
+type frameCodec struct{}
+
+func (frameCodec) Marshal(v any) ([]byte, error) {
+	switch m := v.(type) {
+	case *frame:
+		return m.data, nil
+	case *chunkFrame:
+		return m.data, nil
+	case proto.Message:
+		return proto.Marshal(m)
+	}
+	return nil, fmt.Errorf("frameCodec: cannot marshal %T", v)
+}
+
+func (frameCodec) Unmarshal(data []byte, v any) error {
+	m, ok := v.(proto.Message)
+	if !ok {
+		return fmt.Errorf("frameCodec: cannot unmarshal into %T", v)
+	}
+	return proto.Unmarshal(data, m)
+}
+
+// Name must stay "proto" so clients negotiate the usual content subtype.
+func (frameCodec) Name() string { return "proto" }
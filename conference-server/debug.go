@@ -0,0 +1,63 @@
+package main
+
+import (
+	"expvar"
+	"net/http"
+	_ "net/http/pprof"
+	"os"
+	"runtime"
+	rtmetrics "runtime/metrics"
+)
+
+// --- Debug endpoint ---
+//
+// With DEBUG_ADDR set (e.g. localhost:6060) the server serves net/http/pprof
+// under /debug/pprof/ and expvar under /debug/vars. Besides the standard
+// memstats, /debug/vars publishes "process" with the counters the load
+// generator (cmd/loadgen) samples before and after a run to report CPU time
+// and allocations per message.
+
+var processMetrics = []rtmetrics.Sample{
+	{Name: "/cpu/classes/user:cpu-seconds"},
+	{Name: "/cpu/classes/gc/total:cpu-seconds"},
+	{Name: "/cpu/classes/scavenge/total:cpu-seconds"},
+	{Name: "/gc/heap/allocs:objects"},
+	{Name: "/gc/heap/allocs:bytes"},
+}
+
+func init() {
+	expvar.Publish("process", expvar.Func(func() any {
+		samples := make([]rtmetrics.Sample, len(processMetrics))
+		copy(samples, processMetrics)
+		rtmetrics.Read(samples)
+		value := func(i int) float64 {
+			switch samples[i].Value.Kind() {
+			case rtmetrics.KindFloat64:
+				return samples[i].Value.Float64()
+			case rtmetrics.KindUint64:
+				return float64(samples[i].Value.Uint64())
+			}
+			return 0
+		}
+		return map[string]any{
+			// Go's own estimate of CPU spent running Go code, GC and scavenging.
+			"cpu_seconds":   value(0) + value(1) + value(2),
+			"alloc_objects": value(3),
+			"alloc_bytes":   value(4),
+			"goroutines":    runtime.NumGoroutine(),
+		}
+	}))
+}
+
+func startDebugServer() {
+	addr := os.Getenv("DEBUG_ADDR")
+	if addr == "" {
+		return
+	}
+	go func() {
+		logger.Infof("Debug endpoint listening at %s", addr)
+		if err := http.ListenAndServe(addr, nil); err != nil {
+			logger.Errorf("Debug endpoint stopped: %v", err)
+		}
+	}()
+}
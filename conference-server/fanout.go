@@ -0,0 +1,169 @@
+package main
+
+import (
+	"runtime"
+	"sync"
+	"sync/atomic"
+)
+
+// --- Fan-out engine ---
+//
+// Every room keeps its subscribers in an immutable, contiguous snapshot that
+// is rebuilt only on join/leave. Broadcast loads the snapshot with a single
+// atomic read and walks plain slices, so the per-message cost is a tight loop
+// instead of a sync.Map iteration with type assertions.
+
+// Hot-path loggers. All of them are sampled, and the per-broadcast and
+// per-recipient ones are debug level, so by default a broadcast does not
+// format or write anything.
+var (
+	broadcastLog = logger.Sampled("broadcast")
+	recipientLog = logger.Sampled("recipient")
+	dropLog      = logger.Sampled("drop")
+)
+
+const (
+	// fanoutShardSize is the number of recipients handled by one unit of work.
+	// Rooms with more subscribers than this are split across the worker pool.
+	fanoutShardSize = 64
+)
+
+// subscriberSet is an immutable view of a room's clients. The shards slice
+// shares its backing array with all.
+type subscriberSet struct {
+	all    []*Client
+	shards [][]*Client
+}
+
+var emptySubscribers = &subscriberSet{}
+
+// fanout is the per-room subscriber registry. Writers are serialised by mu and
+// publish a fresh subscriberSet; readers never lock.
+type fanout struct {
+	mu   sync.Mutex
+	subs atomic.Pointer[subscriberSet]
+}
+
+func newFanout() *fanout {
+	f := &fanout{}
+	f.subs.Store(emptySubscribers)
+	return f
+}
+
+func (f *fanout) snapshot() *subscriberSet {
+	return f.subs.Load()
+}
+
+// add publishes a new snapshot that includes c.
+func (f *fanout) add(c *Client) {
+	f.mu.Lock()
+	defer f.mu.Unlock()
+	cur := f.subs.Load().all
+	next := make([]*Client, len(cur), len(cur)+1)
+	copy(next, cur)
+	f.subs.Store(buildSubscriberSet(append(next, c)))
+}
+
+// remove publishes a new snapshot without c.
+func (f *fanout) remove(c *Client) {
+	f.mu.Lock()
+	defer f.mu.Unlock()
+	cur := f.subs.Load().all
+	next := make([]*Client, 0, len(cur))
+	for _, sub := range cur {
+		if sub != c {
+			next = append(next, sub)
+		}
+	}
+	f.subs.Store(buildSubscriberSet(next))
+}
+
+func buildSubscriberSet(all []*Client) *subscriberSet {
+	if len(all) == 0 {
+		return emptySubscribers
+	}
+	set := &subscriberSet{all: all}
+	for start := 0; start < len(all); start += fanoutShardSize {
+		end := start + fanoutShardSize
+		if end > len(all) {
+			end = len(all)
+		}
+		set.shards = append(set.shards, all[start:end:end])
+	}
+	return set
+}
+
+// deliver pushes f to every subscriber of set except the sender. Small rooms
+// are handled inline; large rooms hand all but one shard to the worker pool and
+// process the last shard on the calling goroutine.
+func (set *subscriberSet) deliver(f *frame, except *Client) {
+	if len(set.shards) <= 1 {
+		deliverShard(set.all, f, except)
+		return
+	}
+	var wg sync.WaitGroup
+	last := len(set.shards) - 1
+	for _, shard := range set.shards[:last] {
+		wg.Add(1)
+		fanoutWorkers.submit(fanoutJob{subs: shard, frame: f, except: except, wg: &wg})
+	}
+	deliverShard(set.shards[last], f, except)
+	wg.Wait()
+}
+
+func deliverShard(subs []*Client, f *frame, except *Client) {
+	for _, client := range subs {
+		if client == except {
+			continue
+		}
+		if recipientLog.Enabled(levelDebug) {
+			recipientLog.Debugf("Sending broadcast to %s (%s)", client.id, client.addr)
+		}
+		if !client.enqueue(f) {
+			dropLog.Warnf("Dropped message for client %s (%s policy).", client.id, slowClientPolicy)
+		}
+	}
+}
+
+// --- Worker pool ---
+
+type fanoutJob struct {
+	subs   []*Client
+	frame  *frame
+	except *Client
+	wg     *sync.WaitGroup
+}
+
+type fanoutPool struct {
+	once sync.Once
+	jobs chan fanoutJob
+}
+
+// fanoutWorkers is shared by all rooms so the number of goroutines doing
+// fan-out is bounded by GOMAXPROCS regardless of how many rooms are active.
+var fanoutWorkers = &fanoutPool{}
+
+func (p *fanoutPool) start() {
+	workers := runtime.GOMAXPROCS(0)
+	p.jobs = make(chan fanoutJob, workers*4)
+	for i := 0; i < workers; i++ {
+		go func() {
+			for job := range p.jobs {
+				deliverShard(job.subs, job.frame, job.except)
+				job.wg.Done()
+			}
+		}()
+	}
+}
+
+// submit queues job on the pool, or runs it inline when every worker is busy
+// so a burst of broadcasts can never block behind the pool.
+func (p *fanoutPool) submit(job fanoutJob) {
+	p.once.Do(p.start)
+	select {
+	case p.jobs <- job:
+	default:
+		deliverShard(job.subs, job.frame, job.except)
+		job.wg.Done()
+	}
+}
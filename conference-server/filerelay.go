@@ -0,0 +1,480 @@
+package main
+
+import (
+	"errors"
+	"io"
+	"math"
+	"os"
+	"strconv"
+	"strings"
+	"sync"
+	"sync/atomic"
+	"time"
+
+	"google.golang.org/grpc/codes"
+	"google.golang.org/grpc/status"
+	"google.golang.org/protobuf/proto"
+
+	pb "conference-server/conference"
+)
+
+// --- File chunk relay ---
+//
+// While a sender is connected, its chunks are received and encoded once, then
+// kept in a bounded window shared by all receivers of the transfer (one for a
+// P2P transfer, the whole room for /upload-all). Every receiver has its own
+// goroutine sending from its own position in the window, so a slow receiver
+// only delays itself. A chunk holds one reference per receiver that still has
+// to send it and its slot is reused once the count drops to zero.
+//
+// Every chunk is in the chunk store before it is published, so the window is
+// only the fast path: a receiver that is not in it (it resumed from an older
+// chunk, connected late, or the sender is gone) reads from the store until it
+// catches up.
+//
+// When the window is full and its oldest chunk is still referenced, the
+// relay applies FILE_RELAY_POLICY to the receivers holding it back:
+//   wait  hold the sender for up to FILE_RELAY_TIMEOUT, then detach them
+//         (default)
+//   drop  detach them immediately
+// A detached receiver is not disconnected; it falls back to the store.
+
+type slowReceiverPolicy int
+
+const (
+	relayWait slowReceiverPolicy = iota
+	relayDrop
+)
+
+var (
+	// relayWindow is the number of chunks buffered per transfer (at 64 KB
+	// chunks the default is 4 MB).
+	relayWindow  = envInt("FILE_RELAY_WINDOW", 64)
+	relayPolicy  = parseRelayPolicy(os.Getenv("FILE_RELAY_POLICY"))
+	relayTimeout = time.Duration(envInt("FILE_RELAY_TIMEOUT", 5)) * time.Second
+)
+
+// errRelayDetached means the receiver left the window before the last chunk,
+// either for being too slow or because the sender disconnected.
+var errRelayDetached = errors.New("detached from relay")
+
+func envInt(name string, def int) int {
+	if n, err := strconv.Atoi(os.Getenv(name)); err == nil && n > 0 {
+		return n
+	}
+	return def
+}
+
+func parseRelayPolicy(s string) slowReceiverPolicy {
+	switch strings.ToLower(strings.TrimSpace(s)) {
+	case "wait", "":
+		return relayWait
+	case "drop":
+		return relayDrop
+	}
+	logger.Warnf("Unknown FILE_RELAY_POLICY %q, using wait", s)
+	return relayWait
+}
+
+// chunkFrame is a FileChunk together with its wire encoding; frameCodec
+// sends the bytes as they are.
+type chunkFrame struct {
+	data []byte
+	last bool
+}
+
+type relayChunk struct {
+	f    *chunkFrame
+	refs int // receivers that have not sent this chunk yet
+}
+
+type relayReceiver struct {
+	next    uint64        // chunk number of the next chunk to send
+	ready   chan struct{} // signalled when a chunk is published or the relay ends
+	dropped chan struct{} // closed when the relay detaches this receiver
+}
+
+type fileRelay struct {
+	id        string
+	mu        sync.Mutex
+	ring      []relayChunk
+	tail      uint64 // oldest chunk still in the window
+	head      uint64 // next chunk to be published
+	receivers map[*relayReceiver]struct{}
+	freed     chan struct{} // signalled when a slot is released
+	finished  bool          // sender is done; no more chunks will be published
+}
+
+// newFileRelay creates a relay whose first chunk will be chunk number base.
+func newFileRelay(id string, base uint64) *fileRelay {
+	return &fileRelay{
+		id:        id,
+		ring:      make([]relayChunk, relayWindow),
+		tail:      base,
+		head:      base,
+		receivers: make(map[*relayReceiver]struct{}),
+		freed:     make(chan struct{}, 1),
+	}
+}
+
+func (r *fileRelay) slot(seq uint64) *relayChunk {
+	return &r.ring[seq%uint64(len(r.ring))]
+}
+
+// publish appends a chunk to the window, evicting or waiting for space first.
+func (r *fileRelay) publish(f *chunkFrame) {
+	r.mu.Lock()
+	defer r.mu.Unlock()
+	var deadline time.Time
+	for r.head-r.tail == uint64(len(r.ring)) {
+		oldest := r.slot(r.tail)
+		if oldest.refs == 0 {
+			oldest.f = nil
+			r.tail++
+			continue
+		}
+		if relayPolicy == relayWait {
+			if deadline.IsZero() {
+				deadline = time.Now().Add(relayTimeout)
+			}
+			if wait := time.Until(deadline); wait > 0 {
+				r.mu.Unlock()
+				timer := time.NewTimer(wait)
+				select {
+				case <-r.freed:
+				case <-timer.C:
+				}
+				timer.Stop()
+				r.mu.Lock()
+				continue
+			}
+		}
+		r.dropLagging()
+	}
+	*r.slot(r.head) = relayChunk{f: f, refs: len(r.receivers)}
+	r.head++
+	for rc := range r.receivers {
+		signal(rc.ready)
+	}
+}
+
+// dropLagging detaches every receiver still positioned on the oldest chunk.
+func (r *fileRelay) dropLagging() {
+	for rc := range r.receivers {
+		if rc.next == r.tail {
+			dropLog.Warnf("Slow receiver on transfer %s is %d chunks behind, moving it to the chunk store", r.id, r.head-rc.next)
+			r.detach(rc)
+			close(rc.dropped)
+		}
+	}
+}
+
+// detach releases the references rc holds and forgets it. Caller holds mu.
+func (r *fileRelay) detach(rc *relayReceiver) {
+	if _, ok := r.receivers[rc]; !ok {
+		return
+	}
+	delete(r.receivers, rc)
+	for seq := rc.next; seq < r.head; seq++ {
+		r.slot(seq).refs--
+	}
+	signal(r.freed)
+}
+
+// finish marks the end of the sender's stream.
+func (r *fileRelay) finish() {
+	r.mu.Lock()
+	r.finished = true
+	for rc := range r.receivers {
+		signal(rc.ready)
+	}
+	r.mu.Unlock()
+}
+
+// attach registers a receiver that continues at chunk number from. It fails
+// if that chunk has already left the window or the relay has ended.
+func (r *fileRelay) attach(from uint64) (*relayReceiver, bool) {
+	r.mu.Lock()
+	defer r.mu.Unlock()
+	if r.finished || from < r.tail || from > r.head {
+		return nil, false
+	}
+	rc := &relayReceiver{next: from, ready: make(chan struct{}, 1), dropped: make(chan struct{})}
+	for seq := from; seq < r.head; seq++ {
+		r.slot(seq).refs++
+	}
+	r.receivers[rc] = struct{}{}
+	return rc, true
+}
+
+// serve sends chunks to one receiver. It returns nil after the last chunk,
+// errRelayDetached when the receiver has to continue from the store, or the
+// stream's error. The returned number is the next chunk to send.
+func (r *fileRelay) serve(rc *relayReceiver, stream pb.ConferenceService_TransferFileServer) (uint64, error) {
+	ctx := stream.Context()
+	defer func() {
+		r.mu.Lock()
+		r.detach(rc)
+		r.mu.Unlock()
+	}()
+	for {
+		r.mu.Lock()
+		next := rc.next
+		select {
+		case <-rc.dropped:
+			r.mu.Unlock()
+			return next, errRelayDetached
+		default:
+		}
+		if next == r.head {
+			finished := r.finished
+			r.mu.Unlock()
+			if finished {
+				return next, errRelayDetached
+			}
+			select {
+			case <-rc.ready:
+			case <-rc.dropped:
+			case <-ctx.Done():
+				return next, ctx.Err()
+			}
+			continue
+		}
+		chunk := r.slot(next)
+		f := chunk.f
+		r.mu.Unlock()
+
+		if err := stream.SendMsg(f); err != nil {
+			return next, err
+		}
+
+		r.mu.Lock()
+		if _, ok := r.receivers[rc]; ok {
+			chunk.refs--
+			rc.next++
+			if chunk.refs == 0 {
+				signal(r.freed)
+			}
+		}
+		r.mu.Unlock()
+		if f.last {
+			return next + 1, nil
+		}
+	}
+}
+
+func signal(ch chan struct{}) {
+	select {
+	case ch <- struct{}{}:
+	default:
+	}
+}
+
+// --- Transfer handlers ---
+//
+// A transfer may be uploaded and downloaded over several TransferFile streams
+// at once. Each stream can name the chunks it carries with "chunk-range"
+// metadata ("start-end", end exclusive); a stream without one covers the
+// whole transfer. Uploads get a fresh relay only when their range continues
+// the stored prefix, i.e. a single-stream upload or the first range of a
+// parallel one; every other range goes straight to the store, where
+// receivers pick it up.
+
+// ackInterval is how often, in chunks, the sender is told how far the store
+// has got.
+const ackInterval = 16
+
+// storeWaitTimeout bounds how long a receiver that has caught up waits for a
+// disconnected sender to come back.
+const storeWaitTimeout = 2 * time.Minute
+
+type chunkRange struct{ start, end int32 }
+
+var wholeTransfer = chunkRange{0, math.MaxInt32}
+
+func (r chunkRange) overlaps(o chunkRange) bool {
+	return r.start < o.end && o.start < r.end
+}
+
+// parseChunkRange parses "start-end"; an empty value is the whole transfer.
+func parseChunkRange(v string) (chunkRange, error) {
+	if v == "" {
+		return wholeTransfer, nil
+	}
+	a, b, ok := strings.Cut(v, "-")
+	start, err1 := strconv.ParseInt(a, 10, 32)
+	end, err2 := strconv.ParseInt(b, 10, 32)
+	if !ok || err1 != nil || err2 != nil || start < 0 || end <= start {
+		return chunkRange{}, status.Errorf(codes.InvalidArgument, "invalid chunk-range %q", v)
+	}
+	return chunkRange{int32(start), int32(end)}, nil
+}
+
+// fileTransfer is a P2P or broadcast transfer: its log in the chunk store,
+// the ranges being uploaded, and the relay that serves receivers live.
+type fileTransfer struct {
+	id  string
+	log *transferLog
+
+	mu      sync.Mutex
+	senders []chunkRange
+	relay   *fileRelay
+
+	streams      atomic.Int32 // open TransferFile streams, for /metrics
+	lastActivity atomic.Int64 // unix nanos of the last chunk moved
+}
+
+// touch records progress; see conference_file_transfers_stalled.
+func (t *fileTransfer) touch() {
+	t.lastActivity.Store(time.Now().UnixNano())
+}
+
+func (s *server) newFileTransfer(id string) *fileTransfer {
+	return &fileTransfer{id: id, log: s.chunks.open(id)}
+}
+
+func (t *fileTransfer) liveRelay() *fileRelay {
+	t.mu.Lock()
+	defer t.mu.Unlock()
+	return t.relay
+}
+
+// addSender registers an upload of rg, returning the relay it should publish
+// to (nil if it does not continue the stored prefix).
+func (t *fileTransfer) addSender(rg chunkRange) (*fileRelay, error) {
+	t.mu.Lock()
+	defer t.mu.Unlock()
+	for _, other := range t.senders {
+		if other.overlaps(rg) {
+			return nil, status.Errorf(codes.AlreadyExists, "transfer '%s' already has a sender for chunks %d-%d", t.id, rg.start, rg.end)
+		}
+	}
+	t.senders = append(t.senders, rg)
+	next := t.log.next()
+	if t.relay != nil || t.log.firstMissing(rg.start, rg.end) != next {
+		return nil, nil
+	}
+	t.relay = newFileRelay(t.id, uint64(next))
+	return t.relay, nil
+}
+
+func (t *fileTransfer) removeSender(rg chunkRange, relay *fileRelay) {
+	t.mu.Lock()
+	defer t.mu.Unlock()
+	for i, other := range t.senders {
+		if other == rg {
+			t.senders = append(t.senders[:i], t.senders[i+1:]...)
+			break
+		}
+	}
+	if relay != nil && t.relay == relay {
+		t.relay = nil
+		relay.finish()
+	}
+}
+
+// handleTransferSender stores the sender's chunks and relays them live. The
+// sender first receives an empty chunk whose chunk_number is where it should
+// (re)start within its range, then the same kind of acknowledgement
+// periodically and after its last chunk.
+func (s *server) handleTransferSender(tx *fileTransfer, stream pb.ConferenceService_TransferFileServer, rg chunkRange) error {
+	relay, err := tx.addSender(rg)
+	if err != nil {
+		return err
+	}
+	defer tx.removeSender(rg, relay)
+
+	ack := func() error {
+		return stream.Send(&pb.FileChunk{TransferId: tx.id, ChunkNumber: tx.log.firstMissing(rg.start, rg.end)})
+	}
+	if err := ack(); err != nil {
+		return err
+	}
+	for {
+		chunk, err := stream.Recv()
+		if err == io.EOF {
+			return nil
+		}
+		if err != nil {
+			return err
+		}
+		n := chunk.GetChunkNumber()
+		if n < rg.start || n >= rg.end {
+			return status.Errorf(codes.OutOfRange, "chunk %d outside of range %d-%d", n, rg.start, rg.end)
+		}
+		fresh, err := s.chunks.append(tx.log, chunk)
+		tx.touch()
+		if err != nil {
+			if errors.Is(err, errChunkRange) {
+				return status.Errorf(codes.OutOfRange, "transfer %s: %v", tx.id, err)
+			}
+			return status.Errorf(codes.Internal, "storing chunk %d of transfer %s: %v", n, tx.id, err)
+		}
+		if fresh && relay != nil && uint64(n) == relay.head {
+			data, err := proto.Marshal(chunk)
+			if err != nil {
+				return status.Errorf(codes.Internal, "encoding chunk: %v", err)
+			}
+			relay.publish(&chunkFrame{data: data, last: chunk.GetIsLast()})
+		}
+		if chunk.GetIsLast() {
+			return ack()
+		}
+		if n%ackInterval == 0 {
+			if err := ack(); err != nil {
+				return err
+			}
+		}
+	}
+}
+
+// handleTransferReceiver sends chunks [from, rg.end) of the transfer to a
+// receiver. It follows the live relay whenever it can and reads from the
+// chunk store otherwise.
+func (s *server) handleTransferReceiver(tx *fileTransfer, stream pb.ConferenceService_TransferFileServer, from int32, rg chunkRange) error {
+	ctx := stream.Context()
+	from = max(from, rg.start)
+	for from < rg.end {
+		if relay := tx.liveRelay(); relay != nil && rg == wholeTransfer {
+			if rc, ok := relay.attach(uint64(from)); ok {
+				next, err := relay.serve(rc, stream)
+				from = int32(next)
+				if !errors.Is(err, errRelayDetached) {
+					return err
+				}
+			}
+		}
+
+		stored, beyondEnd, changed := tx.log.state(from)
+		if stored {
+			chunk, err := s.chunks.read(tx.log, from)
+			if err != nil {
+				return status.Errorf(codes.DataLoss, "reading chunk %d of transfer %s: %v", from, tx.id, err)
+			}
+			chunk.TransferId = tx.id
+			if err := stream.Send(chunk); err != nil {
+				return err
+			}
+			tx.touch()
+			if chunk.GetIsLast() {
+				return nil
+			}
+			from++
+			continue
+		}
+		if beyondEnd {
+			return nil
+		}
+		timer := time.NewTimer(storeWaitTimeout)
+		select {
+		case <-changed:
+			timer.Stop()
+		case <-ctx.Done():
+			timer.Stop()
+			return ctx.Err()
+		case <-timer.C:
+			return status.Errorf(codes.Unavailable, "sender of transfer %s is gone", tx.id)
+		}
+	}
+	return nil
+}
@@ -0,0 +1,117 @@
+package main
+
+import (
+	"fmt"
+	"sync"
+	"time"
+
+	pb "conference-server/conference"
+)
+
+// --- Room history ---
+//
+// Every room keeps its most recent chat, command, roster and file-announcement
+// broadcasts in a fixed ring of HISTORY_SIZE frames, each stamped with a
+// per-room sequence number in header.room_seq. The ring is allocated with the
+// room and holds the frames Broadcast has already encoded, so recording a
+// message allocates nothing.
+//
+// A client that joins gets the last HISTORY_JOIN_REPLAY messages right after
+// WELCOME. A client that rejoins sends the room's history_epoch and the last
+// room_seq it saw in its JOIN and gets exactly what it missed, as far back
+// as the ring reaches. The epoch changes whenever a room is recreated (rooms
+// are deleted once empty), so sequence numbers from an earlier incarnation
+// are never taken for current ones.
+//
+// Sequencing, recording and fan-out of these messages happen under one lock,
+// and clients join under it too, so a joiner sees every sequenced message
+// once and in order: either in its replay or live. Audio is not recorded and
+// never takes the lock.
+
+var (
+	historySize       = max(envInt("HISTORY_SIZE", 128), 1)
+	historyJoinReplay = max(envInt("HISTORY_JOIN_REPLAY", 20), 0)
+)
+
+type roomHistory struct {
+	mu    sync.Mutex
+	epoch uint64
+	seq   uint64   // last sequence number handed out
+	ring  []*frame // message n lives at ring[n % len(ring)]
+}
+
+func newRoomHistory() *roomHistory {
+	return &roomHistory{epoch: uint64(time.Now().UnixNano()), ring: make([]*frame, historySize)}
+}
+
+// isHistory reports whether msg is kept in the room history.
+func isHistory(msg *pb.ConferenceData) bool {
+	switch msg.GetPayload().(type) {
+	case *pb.ConferenceData_TextMessage, *pb.ConferenceData_Command, *pb.ConferenceData_FileAnnouncement, *pb.ConferenceData_Roster:
+		return true
+	}
+	return false
+}
+
+// next stamps msg with the following sequence number. Called with h.mu held.
+func (h *roomHistory) next(msg *pb.ConferenceData) {
+	h.seq++
+	if msg.Header == nil {
+		msg.Header = &pb.FrameHeader{}
+	}
+	msg.Header.RoomSeq = h.seq
+}
+
+// record stores f, the encoding of the message last stamped by next.
+func (h *roomHistory) record(f *frame) {
+	h.ring[h.seq%uint64(len(h.ring))] = f
+}
+
+// replay queues on c the messages after seq after, at most limit of them,
+// newest last. Called with h.mu held.
+func (h *roomHistory) replay(c *Client, after uint64, limit int) {
+	from := after + 1
+	if n := uint64(len(h.ring)); h.seq >= n && from < h.seq-n+1 {
+		from = h.seq - n + 1
+	}
+	if l := uint64(limit); h.seq >= l && from < h.seq-l+1 {
+		from = h.seq - l + 1
+	}
+	for seq := from; seq <= h.seq; seq++ {
+		if f := h.ring[seq%uint64(len(h.ring))]; f != nil {
+			if f.traced {
+				// Not stamped again on the way out: the time since it was
+				// received is not server latency.
+				f = &frame{data: f.data, kind: f.kind}
+			}
+			c.enqueue(f)
+		}
+	}
+}
+
+// join adds c to the room (see addClient for claim), then queues WELCOME
+// and the history c is owed: what it missed since resume's history_seq if
+// resume names the current epoch, else the latest HISTORY_JOIN_REPLAY
+// messages. Replays are capped at half of the reliable lane so they cannot
+// crowd out live traffic.
+func (r *Room) join(c *Client, resume *pb.Command, claim *resumeClaim) (displaced *Client, kept bool, err error) {
+	h := r.history
+	h.mu.Lock()
+	defer h.mu.Unlock()
+	if displaced, kept, err = r.addClient(c, claim); err != nil {
+		return nil, false, err
+	}
+	c.enqueue(serverFrame(&pb.ConferenceData{
+		Payload: &pb.ConferenceData_Command{Command: &pb.Command{
+			Type: "WELCOME", Value: fmt.Sprintf("Welcome to room '%s'", r.id), AudioCodecs: []pb.AudioCodec{r.AudioCodec()},
+			Participants: r.participants(), HistoryEpoch: h.epoch, HistorySeq: h.seq,
+			ResumeToken: issueResumeToken(r.id, c),
+		}},
+	}))
+	after, limit := uint64(0), historyJoinReplay
+	if resume.GetHistoryEpoch() == h.epoch && resume.GetHistorySeq() > 0 {
+		after, limit = resume.GetHistorySeq(), historySize
+	}
+	h.replay(c, after, min(limit, cap(c.ch)/2))
+	return displaced, kept, nil
+}
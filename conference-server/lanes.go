@@ -0,0 +1,180 @@
+package main
+
+import (
+	"sync"
+	"time"
+)
+
+// --- Per-client priority lanes ---
+//
+// Each client has two outbound lanes drained by its sender goroutine:
+//   - a reliable lane (buffered channel) for chat, commands, file
+//     announcements and everything else that must not be lost;
+//   - a small latest-wins audio ring. When it is full the oldest frame is
+//     discarded, so audio queueing delay is bounded by the ring size and an
+//     audio burst can never push chat out of the reliable lane.
+
+const (
+	reliableLaneSize = 256
+	// audioRingSize bounds queued audio per client; at ~11.6 ms per PCM chunk
+	// this is under 100 ms of audio.
+	audioRingSize = 8
+)
+
+type audioRing struct {
+	mu      sync.Mutex
+	buf     [audioRingSize]*frame
+	head    int // index of the oldest frame
+	n       int
+	dropped uint64
+	ready   chan struct{} // signalled when the ring goes from empty to non-empty
+}
+
+func newAudioRing() *audioRing {
+	return &audioRing{ready: make(chan struct{}, 1)}
+}
+
+// push appends f, overwriting the oldest frame when the ring is full. It
+// reports whether a frame was discarded.
+func (r *audioRing) push(f *frame) bool {
+	r.mu.Lock()
+	overwrote := false
+	if r.n == audioRingSize {
+		r.buf[r.head] = f
+		r.head = (r.head + 1) % audioRingSize
+		r.dropped++
+		overwrote = true
+	} else {
+		r.buf[(r.head+r.n)%audioRingSize] = f
+		r.n++
+	}
+	r.mu.Unlock()
+	select {
+	case r.ready <- struct{}{}:
+	default:
+	}
+	return overwrote
+}
+
+// pop removes and returns the oldest frame, or nil when the ring is empty.
+func (r *audioRing) pop() *frame {
+	r.mu.Lock()
+	defer r.mu.Unlock()
+	if r.n == 0 {
+		return nil
+	}
+	f := r.buf[r.head]
+	r.buf[r.head] = nil
+	r.head = (r.head + 1) % audioRingSize
+	r.n--
+	return f
+}
+
+func (r *audioRing) len() int {
+	r.mu.Lock()
+	defer r.mu.Unlock()
+	return r.n
+}
+
+func (r *audioRing) droppedCount() uint64 {
+	r.mu.Lock()
+	defer r.mu.Unlock()
+	return r.dropped
+}
+
+func isAudio(f *frame) bool {
+	return f.kind == kindAudio
+}
+
+// enqueue places f on the lane matching its payload without blocking,
+// applying the slow-consumer policy (see slowclients.go). It returns false
+// when f was dropped instead of queued.
+func (c *Client) enqueue(f *frame) bool {
+	audio := isAudio(f)
+	if c.shed(f, audio) {
+		if audio {
+			metrics.droppedAudio.add(1)
+		} else {
+			c.dropReliable()
+		}
+		return false
+	}
+	if audio {
+		if c.audio.push(f) {
+			metrics.droppedAudio.add(1)
+			dropLog.Debugf("Dropped oldest audio frame for client %s, audio lane full.", c.id)
+		}
+		return true
+	}
+	select {
+	case c.ch <- f:
+		return true
+	default:
+	}
+	if slowClientPolicy == slowDropOldest {
+		select {
+		case <-c.ch:
+			c.dropReliable()
+		default:
+		}
+		// Another sender may have taken the slot; then f is dropped after all.
+		select {
+		case c.ch <- f:
+			return true
+		default:
+		}
+	}
+	c.dropReliable()
+	return false
+}
+
+// sendLoop writes queued frames to the client's stream until the client
+// leaves or the stream fails.
+func (c *Client) sendLoop() {
+	if c.batching {
+		c.batchLoop()
+		return
+	}
+	for {
+		select {
+		case <-c.done:
+			return
+		case f := <-c.ch:
+			if !c.send(f) {
+				return
+			}
+		case <-c.audio.ready:
+			for f := c.audio.pop(); f != nil; f = c.audio.pop() {
+				if !c.send(f) {
+					return
+				}
+			}
+		}
+		if !c.reportSlow() {
+			return
+		}
+	}
+}
+
+func (c *Client) send(f *frame) bool {
+	if f.traced {
+		f = stampSent(f, time.Now())
+	}
+	return c.write(f)
+}
+
+// stampSent records how long a traced frame spent in the server and returns
+// the copy to write, carrying the send stamp.
+func stampSent(f *frame, now time.Time) *frame {
+	metrics.tracedLatency.observe(now.Sub(time.UnixMicro(f.recvUs)))
+	return f.withSendStamp(now)
+}
+
+func (c *Client) write(f *frame) bool {
+	if err := c.stream.SendMsg(f); err != nil {
+		// The main loop will detect the stream error and clean up.
+		logger.Warnf("Error sending to client %s: %v. Stopping sender.", c.id, err)
+		return false
+	}
+	return true
+}
@@ -0,0 +1,250 @@
+package main
+
+import (
+	"bufio"
+	"fmt"
+	"io"
+	"os"
+	"strconv"
+	"strings"
+	"sync"
+	"sync/atomic"
+	"time"
+)
+
+// --- Logging ---
+//
+// The server logs through a leveled logger with an asynchronous, buffered
+// sink: callers format into a channel and a single goroutine owns the writer,
+// so no request path ever holds a mutex on stderr. When the buffer is full,
+// lines are dropped and counted instead of blocking the caller.
+//
+// Configuration (environment):
+//   LOG_LEVEL   debug | info | warning | error (default: info)
+//   LOG_SAMPLE  per-event sampling, e.g. "broadcast=100,drop=50" logs one in
+//               every N occurrences of that event (events: broadcast,
+//               recipient, drop)
+//   LOG_BUFFER  number of lines buffered before dropping (default: 4096)
+
+type logLevel int32
+
+const (
+	levelDebug logLevel = iota
+	levelInfo
+	levelWarn
+	levelError
+)
+
+var levelNames = [...]string{"DEBUG", "INFO", "WARN", "ERROR"}
+
+func parseLogLevel(s string) (logLevel, bool) {
+	switch strings.ToLower(strings.TrimSpace(s)) {
+	case "debug":
+		return levelDebug, true
+	case "info", "":
+		return levelInfo, true
+	case "warn", "warning":
+		return levelWarn, true
+	case "error":
+		return levelError, true
+	}
+	return levelInfo, false
+}
+
+// defaultSampleRates keeps the high-volume hot-path events quiet even when
+// debug logging is enabled. Every other event logs each occurrence.
+var defaultSampleRates = map[string]uint64{
+	"broadcast": 1000,
+	"recipient": 1000,
+	"drop":      100,
+}
+
+type leveledLogger struct {
+	level   atomic.Int32
+	lines   chan string
+	dropped atomic.Uint64
+	out     io.Writer
+	closed  atomic.Bool
+	stop    chan struct{} // closed once by Close; lines itself never is
+	done    chan struct{}
+	once    sync.Once
+
+	mu       sync.Mutex
+	rates    map[string]uint64
+	samplers map[string]*sampler
+}
+
+var logger = newLogger(os.Stderr)
+
+func newLogger(out io.Writer) *leveledLogger {
+	l := &leveledLogger{
+		out:      out,
+		stop:     make(chan struct{}),
+		done:     make(chan struct{}),
+		rates:    make(map[string]uint64),
+		samplers: make(map[string]*sampler),
+	}
+	for event, every := range defaultSampleRates {
+		l.rates[event] = every
+	}
+
+	level, ok := parseLogLevel(os.Getenv("LOG_LEVEL"))
+	l.level.Store(int32(level))
+	size := 4096
+	if n, err := strconv.Atoi(os.Getenv("LOG_BUFFER")); err == nil && n > 0 {
+		size = n
+	}
+	l.lines = make(chan string, size)
+	l.parseSampleRates(os.Getenv("LOG_SAMPLE"))
+
+	go l.run()
+	if !ok {
+		l.Warnf("Unknown LOG_LEVEL %q, using info", os.Getenv("LOG_LEVEL"))
+	}
+	return l
+}
+
+func (l *leveledLogger) parseSampleRates(spec string) {
+	for _, entry := range strings.Split(spec, ",") {
+		event, value, found := strings.Cut(strings.TrimSpace(entry), "=")
+		if !found {
+			continue
+		}
+		every, err := strconv.ParseUint(value, 10, 64)
+		if err != nil || every == 0 {
+			continue
+		}
+		l.rates[event] = every
+	}
+}
+
+func (l *leveledLogger) enabled(level logLevel) bool {
+	return level >= logLevel(l.level.Load())
+}
+
+func (l *leveledLogger) format(level logLevel, format string, args ...any) string {
+	return time.Now().Format("2006/01/02 15:04:05 ") + levelNames[level] + " " + fmt.Sprintf(format, args...)
+}
+
+// emit queues a line. After Close, lines are discarded: goroutines that
+// outlive Serve may still log while the process exits.
+func (l *leveledLogger) emit(level logLevel, format string, args ...any) {
+	if !l.enabled(level) || l.closed.Load() {
+		return
+	}
+	line := l.format(level, format, args...)
+	select {
+	case l.lines <- line:
+	default:
+		l.dropped.Add(1)
+	}
+}
+
+func (l *leveledLogger) Debugf(format string, args ...any) { l.emit(levelDebug, format, args...) }
+func (l *leveledLogger) Infof(format string, args ...any)  { l.emit(levelInfo, format, args...) }
+func (l *leveledLogger) Warnf(format string, args ...any)  { l.emit(levelWarn, format, args...) }
+func (l *leveledLogger) Errorf(format string, args ...any) { l.emit(levelError, format, args...) }
+
+// Fatalf drains the buffer, writes its line synchronously, then exits.
+func (l *leveledLogger) Fatalf(format string, args ...any) {
+	line := l.format(levelError, format, args...)
+	l.Close()
+	fmt.Fprintln(l.out, line)
+	os.Exit(1)
+}
+
+// Close stops accepting lines and waits until everything buffered is
+// written. It may be called more than once, and concurrently.
+func (l *leveledLogger) Close() {
+	l.once.Do(func() {
+		l.closed.Store(true)
+		close(l.stop)
+	})
+	<-l.done
+}
+
+func (l *leveledLogger) run() {
+	defer close(l.done)
+	w := bufio.NewWriterSize(l.out, 64*1024)
+	var reported uint64
+	write := func(line string) {
+		w.WriteString(line)
+		w.WriteByte('\n')
+		// Flush only once the queue is drained so bursts cost one write.
+		if len(l.lines) == 0 {
+			if dropped := l.dropped.Load(); dropped != reported {
+				fmt.Fprintf(w, "%s WARN %d log lines dropped, buffer full\n", time.Now().Format("2006/01/02 15:04:05"), dropped-reported)
+				reported = dropped
+			}
+			w.Flush()
+		}
+	}
+	for {
+		select {
+		case line := <-l.lines:
+			write(line)
+		case <-l.stop:
+			for {
+				select {
+				case line := <-l.lines:
+					write(line)
+				default:
+					w.Flush()
+					return
+				}
+			}
+		}
+	}
+}
+
+// --- Sampling ---
+
+// sampler logs one in every N occurrences of an event. A sampler for an
+// unconfigured event logs everything.
+type sampler struct {
+	l     *leveledLogger
+	event string
+	every uint64
+	count atomic.Uint64
+}
+
+// Sampled returns the sampler for event, creating it on first use. Hot paths
+// should keep the returned sampler in a package variable.
+func (l *leveledLogger) Sampled(event string) *sampler {
+	l.mu.Lock()
+	defer l.mu.Unlock()
+	if s, ok := l.samplers[event]; ok {
+		return s
+	}
+	every := l.rates[event]
+	if every == 0 {
+		every = 1
+	}
+	s := &sampler{l: l, event: event, every: every}
+	l.samplers[event] = s
+	return s
+}
+
+// Enabled reports whether a call at level would be considered at all. Use it
+// to skip building arguments on hot paths.
+func (s *sampler) Enabled(level logLevel) bool {
+	return s.l.enabled(level)
+}
+
+func (s *sampler) emit(level logLevel, format string, args ...any) {
+	if !s.l.enabled(level) {
+		return
+	}
+	n := s.count.Add(1)
+	if s.every > 1 {
+		if n%s.every != 1 {
+			return
+		}
+		format += " [" + s.event + " sampled 1/" + strconv.FormatUint(s.every, 10) + ", seen " + strconv.FormatUint(n, 10) + "]"
+	}
+	s.l.emit(level, format, args...)
+}
+
+func (s *sampler) Debugf(format string, args ...any) { s.emit(levelDebug, format, args...) }
+func (s *sampler) Infof(format string, args ...any)  { s.emit(levelInfo, format, args...) }
+func (s *sampler) Warnf(format string, args ...any)  { s.emit(levelWarn, format, args...) }
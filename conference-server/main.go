@@ -1,18 +1,17 @@
 package main
 
 import (
-	"context"
 	"fmt"
 	"io"
-	"log"
 	"net"
+	"strconv"
 	"sync"
+	"sync/atomic"
 	"time"
 
 	"google.golang.org/grpc"
 	"google.golang.org/grpc/codes"
 	"google.golang.org/grpc/metadata"
-	"google.golang.org/grpc/peer"
 	"google.golang.org/grpc/status"
 
 	pb "conference-server/conference"
@@ -21,41 +20,110 @@ import (
 // --- Structs for managing state ---
 
 type Client struct {
-	id     string // sender ID / username
-	addr   string
-	ch     chan *pb.ConferenceData
-	stream pb.ConferenceService_JoinConferenceServer
+	id       string // sender ID / username
+	pid      uint32 // room-scoped participant ID, see participants.go
+	addr     string
+	opus     bool        // advertised Opus support in its JOIN command
+	batching bool        // accepts ConferenceBatch, see batching.go
+	ch       chan *frame // reliable lane: chat, commands, file announcements
+	audio    *audioRing  // latest-wins lane for audio chunks
+	dropped  counter     // reliable-lane frames dropped because the lane was full
+	slow     slowState   // slow-consumer policy state, see slowclients.go
+	done     chan struct{}
+	stream   pb.ConferenceService_JoinConferenceServer
+
+	announced atomic.Bool    // the others have been told about this participant, see presence.go
+	quiet     atomic.Bool    // leaving is not announced (displaced by a resumed session)
+	header    pb.FrameHeader // spare header for received frames, see identify
+
+	kicked   chan struct{} // closed to end the session early, see kick
+	kickErr  error         // status JoinConference returns once kicked
+	kickOnce sync.Once
+
+	handling sync.Mutex // held while a received message is handled
+	cutOff   bool       // kicked: received messages are dropped, guarded by handling
 }
 
 type Room struct {
 	id      string
-	clients *sync.Map // map[clientAddr]*Client
-	users   *sync.Map // map[senderID]*Client
+	mu      sync.Mutex
+	users   map[string]*Client // map[senderID]*Client
+	clients *fanout            // subscriber snapshot used by Broadcast
+	lastPID uint32             // last participant ID handed out, guarded by mu
+
+	audioMu  sync.Mutex
+	mixer    *mixer           // non-nil while the room is in mix audio mode
+	selector *speakerSelector // non-nil while the room is in select audio mode
+	codec    pb.AudioCodec    // codec participants are asked to send
+
+	history  *roomHistory // recent chat, commands and announcements, see history.go
+	presence presence     // pending roster changes, see presence.go
+
+	broadcasts     counter // messages fanned out, for /metrics
+	broadcastNanos counter // time spent fanning out
 }
 
 func NewRoom(id string) *Room {
 	return &Room{
 		id:      id,
-		clients: &sync.Map{},
-		users:   &sync.Map{},
+		users:   make(map[string]*Client),
+		clients: newFanout(),
+		history: newRoomHistory(),
 	}
 }
 
 // AddClient adds a client to the room, checking for username uniqueness.
 func (r *Room) AddClient(c *Client) error {
+	_, _, err := r.addClient(c, nil)
+	return err
+}
+
+// addClient adds c to the room. With a resume claim (see resume.go) c takes
+// over from a client still registered under its name, which is returned as
+// displaced, and gets its claimed participant ID back if no one else holds
+// it; kept reports whether it did.
+func (r *Room) addClient(c *Client, claim *resumeClaim) (displaced *Client, kept bool, err error) {
+	r.mu.Lock()
+	defer r.mu.Unlock()
 	// Check if username is already taken
-	if _, ok := r.users.Load(c.id); ok {
-		return fmt.Errorf("username '%s' is already taken", c.id)
+	old, taken := r.users[c.id]
+	if taken && claim == nil {
+		return nil, false, fmt.Errorf("username '%s' is already taken", c.id)
 	}
-	r.clients.Store(c.addr, c)
-	r.users.Store(c.id, c)
-	return nil
+	if claim != nil && claim.PID != 0 && r.pidFree(claim.PID, old) {
+		c.pid, kept = claim.PID, true
+		r.lastPID = max(r.lastPID, c.pid)
+	} else {
+		r.lastPID++
+		c.pid = r.lastPID
+	}
+	r.users[c.id] = c
+	r.clients.add(c)
+	return old, kept, nil
 }
 
 // RemoveClient removes a client from the room.
 func (r *Room) RemoveClient(c *Client) {
-	r.clients.Delete(c.addr)
-	r.users.Delete(c.id)
+	r.mu.Lock()
+	defer r.mu.Unlock()
+	if r.users[c.id] == c {
+		delete(r.users, c.id)
+	}
+	r.clients.remove(c)
+	if m := r.activeMixer(); m != nil {
+		m.remove(c)
+	}
+	if sel := r.activeSelector(); sel != nil {
+		sel.remove(c)
+	}
+}
+
+// Lookup returns the client registered under the given username.
+func (r *Room) Lookup(senderID string) (*Client, bool) {
+	r.mu.Lock()
+	defer r.mu.Unlock()
+	c, ok := r.users[senderID]
+	return c, ok
 }
 
 // server implements the conference.ConferenceServiceServer interface.
@@ -64,278 +132,349 @@ type server struct {
 	rooms sync.Map // map[roomID]*Room
 
 	// File transfer state
-	transferResponses map[string]chan *pb.FileTransferResponse
-	transferMu        sync.Mutex
-	activeTransfers   sync.Map // map[transferID]transfer (p2pTransfer or broadcastTransfer)
+	offers          *offerTable
+	offerWheel      *timerWheel
+	activeTransfers sync.Map // map[transferID]*fileTransfer
+	chunks          *chunkStore
+
+	cluster  *cluster    // nil when running standalone
+	draining atomic.Bool // set on shutdown; new streams are refused
 }
 
-func newServer() *server {
-	return &server{
-		transferResponses: make(map[string]chan *pb.FileTransferResponse),
+func newServer(chunks *chunkStore, cl *cluster) *server {
+	s := &server{
+		offers:  newOfferTable(),
+		chunks:  chunks,
+		cluster: cl,
 	}
+	s.offerWheel = newTimerWheel(s.expireOffer)
+	metrics.collect(s.collectState)
+	chunks.onExpire = func(transferID string) { s.activeTransfers.Delete(transferID) }
+	return s
 }
 
 // --- JoinConference: Main communication stream ---
 
 func (s *server) JoinConference(stream pb.ConferenceService_JoinConferenceServer) error {
-	p, _ := peer.FromContext(stream.Context())
-	clientAddr := p.Addr.String()
+	if s.draining.Load() {
+		return status.Error(codes.Unavailable, "server is draining, reconnect shortly")
+	}
+	clientAddr := s.cluster.clientAddr(stream.Context())
 
-	initialMsg, err := stream.Recv()
+	firstMsg, err := stream.Recv()
 	if err != nil {
 		return status.Errorf(codes.InvalidArgument, "Failed to receive initial message: %v", err)
 	}
+	// A batching client may send its JOIN inside a batch; what follows it
+	// is handled once the client is in the room.
+	initialMsg, pending := firstMsg, []*pb.ConferenceData(nil)
+	if batch := firstMsg.GetBatch(); batch != nil && len(batch.Messages) > 0 {
+		metrics.batchedIn.add(uint64(len(batch.Messages)))
+		initialMsg, pending = batch.Messages[0], batch.Messages[1:]
+	}
 	roomID := initialMsg.GetRoomId()
 	senderID := initialMsg.GetSender()
 	if roomID == "" || senderID == "" {
 		return status.Errorf(codes.InvalidArgument, "room_id and sender must be provided")
 	}
+	if owner := s.cluster.route(stream.Context(), roomID); owner != nil {
+		return s.cluster.proxyJoin(owner, stream, firstMsg, initialMsg)
+	}
 
 	// Get or create room
-	r, _ := s.rooms.LoadOrStore(roomID, NewRoom(roomID))
+	r, loaded := s.rooms.Load(roomID)
+	if !loaded {
+		// Rooms preallocate their history ring, so only build one when needed.
+		r, loaded = s.rooms.LoadOrStore(roomID, NewRoom(roomID))
+	}
 	room := r.(*Room)
+	if !loaded {
+		room.SetAudioMode(defaultAudioMode)
+	}
 
 	// Create and add client
 	client := &Client{
-		id:     senderID,
-		addr:   clientAddr,
-		ch:     make(chan *pb.ConferenceData, 100),
-		stream: stream,
+		id:       senderID,
+		addr:     clientAddr,
+		opus:     supportsOpus(initialMsg.GetCommand().GetAudioCodecs()),
+		batching: initialMsg.GetCommand().GetBatching(),
+		ch:       make(chan *frame, reliableLaneSize),
+		audio:    newAudioRing(),
+		done:     make(chan struct{}),
+		stream:   stream,
+		kicked:   make(chan struct{}),
 	}
-	if err := room.AddClient(client); err != nil {
-		log.Printf("Client '%s' failed to join room '%s': %v", senderID, roomID, err)
+	var claim *resumeClaim
+	if token := initialMsg.GetCommand().GetResumeToken(); token != "" {
+		if claim, err = verifyResumeToken(token, roomID, senderID); err != nil {
+			logger.Infof("Client '%s' sent an unusable resume token for room '%s', joining normally", senderID, roomID)
+		}
+	}
+	displaced, kept, err := room.join(client, initialMsg.GetCommand(), claim)
+	if err != nil {
+		logger.Warnf("Client '%s' failed to join room '%s': %v", senderID, roomID, err)
 		// Send error back to client before closing
-		stream.Send(&pb.ConferenceData{
-			Payload: &pb.ConferenceData_Command{Command: &pb.Command{Type: "ERROR", Value: err.Error()}},
-		})
+		stream.Send(serverError(pb.ErrorCode_ERROR_NAME_TAKEN, true, err.Error()))
 		return status.Error(codes.AlreadyExists, err.Error())
 	}
-	log.Printf("Client '%s' (%s) joined room '%s'", senderID, clientAddr, roomID)
+	if displaced != nil {
+		displaced.quiet.Store(true)
+		displaced.kick(status.Error(codes.Aborted, "session resumed on another stream"))
+	}
+	if claim != nil {
+		logger.Infof("Client '%s' (%s) resumed in room '%s'", senderID, clientAddr, roomID)
+	} else {
+		logger.Infof("Client '%s' (%s) joined room '%s'", senderID, clientAddr, roomID)
+	}
 
 	defer func() {
 		room.RemoveClient(client)
-		close(client.ch)
-		log.Printf("Client '%s' left room '%s'", senderID, roomID)
+		close(client.done)
+		logger.Infof("Client '%s' left room '%s'", senderID, roomID)
 		if room.IsEmpty() {
 			s.rooms.Delete(roomID)
-			log.Printf("Room '%s' is empty and deleted.", roomID)
+			room.SetAudioMode(audioRelay)
+			logger.Infof("Room '%s' is empty and deleted.", roomID)
 		} else {
-			room.Broadcast(&pb.ConferenceData{
-				Sender: "Server", RoomId: roomID,
-				Payload: &pb.ConferenceData_Command{Command: &pb.Command{Type: "USER_LEFT", Value: senderID}},
-			}, "")
+			if !client.quiet.Load() && !s.draining.Load() {
+				room.announceLeave(client)
+			}
+			room.refreshAudioCodec()
 		}
 	}()
 	
-	// Announce new user
-	room.Broadcast(&pb.ConferenceData{
-		Sender: "Server", RoomId: roomID,
-		Payload: &pb.ConferenceData_Command{Command: &pb.Command{Type: "USER_JOINED", Value: senderID}},
-	}, "")
+	// Announce new user. A resumed session is not news, unless it had to take
+	// a new participant ID that the others need to learn.
+	if claim != nil && kept {
+		client.announced.Store(true)
+	} else {
+		room.announceJoin(client, claim != nil)
+	}
 	
-	// Welcome message to the user
-	client.ch <- &pb.ConferenceData{
-		Payload: &pb.ConferenceData_Command{Command: &pb.Command{Type: "WELCOME", Value: fmt.Sprintf("Welcome to room '%s'", roomID)}},
-	}
-
-	// Goroutine to send messages from channel to the client's stream
-	go func() {
-		for msg := range client.ch {
-			if err := client.stream.Send(msg); err != nil {
-				log.Printf("Error sending to client %s: %v. Closing channel.", client.id, err)
-				// The main loop will detect the stream error and clean up.
-				return
-			}
-		}
-	}()
+	room.refreshAudioCodec()
+
+	// Goroutine to send messages from the client's lanes to its stream
+	go client.sendLoop()
 
-	// Main loop to process incoming messages from this client
+	// Incoming messages are read on their own goroutine so that a client
+	// that is kicked (too slow, or resumed elsewhere) is cut off even while
+	// Recv is blocked.
+	received := make(chan error, 1)
+	go func() { received <- s.receive(stream, room, client, pending) }()
+	select {
+	case err := <-received:
+		return err
+	case <-client.kicked:
+		// Wait for a message being handled and drop any that follow: the
+		// client is about to leave the room. The pending RecvMsg returns once
+		// the stream's context is cancelled, when we return.
+		client.handling.Lock()
+		client.cutOff = true
+		client.handling.Unlock()
+		return client.kickErr
+	}
+}
+
+// receive processes the messages client sends until its stream ends. Every
+// message is decoded into the same envelope: handling is synchronous and
+// frames keep only their encoding, so nothing refers to a message once
+// handleMessage has returned and it can be overwritten by the next one.
+// pending, the messages batched after the JOIN, are handled first.
+func (s *server) receive(stream pb.ConferenceService_JoinConferenceServer, room *Room, client *Client, pending []*pb.ConferenceData) error {
+	for _, m := range pending {
+		if !s.handleReceived(room, client, m) { return nil }
+	}
+	msg := new(pb.ConferenceData)
 	for {
-		msg, err := stream.Recv()
+		err := stream.RecvMsg(msg)
 		if err == io.EOF { return nil }
 		if err != nil { return err }
-
-		switch payload := msg.Payload.(type) {
-		case *pb.ConferenceData_PrivateMessage:
-			s.handlePrivateMessage(room, client, payload.PrivateMessage)
-		case *pb.ConferenceData_FileAnnouncement:
-			log.Printf("File announcement from '%s' in room '%s' for '%s'", msg.Sender, msg.RoomId, payload.FileAnnouncement.Filename)
-			s.activeTransfers.Store(payload.FileAnnouncement.TransferId, &broadcastTransfer{})
-			room.Broadcast(msg, client.addr)
-		default:
-			room.Broadcast(msg, client.addr)
+		if batch := msg.GetBatch(); batch != nil {
+			metrics.batchedIn.add(uint64(len(batch.Messages)))
+			for _, m := range batch.Messages {
+				if !s.handleReceived(room, client, m) { return nil }
+			}
+			continue
 		}
+		if !s.handleReceived(room, client, msg) { return nil }
 	}
 }
 
-// --- Message Handling ---
+// handleReceived handles msg, unless client has been kicked; then it
+// reports false and receive stops.
+func (s *server) handleReceived(room *Room, client *Client, msg *pb.ConferenceData) bool {
+	client.handling.Lock()
+	defer client.handling.Unlock()
+	if client.cutOff { return false }
+	s.handleMessage(room, client, msg)
+	return true
+}
 
-func (r *Room) Broadcast(msg *pb.ConferenceData, senderAddr string) {
-	log.Printf("Broadcasting message from sender with address: %s", senderAddr)
-	r.clients.Range(func(key, value interface{}) bool {
-		clientAddr := key.(string)
-		client := value.(*Client)
+// handleMessage processes one frame from client's stream.
+func (s *server) handleMessage(room *Room, client *Client, msg *pb.ConferenceData) {
+	stampReceived(msg)
+	client.identify(msg)
+	if !client.announced.Load() {
+		room.flushPresence()
+	}
 
-		if senderAddr != "" && clientAddr == senderAddr {
-			log.Printf("Skipping broadcast to sender %s (%s)", client.id, clientAddr)
-			return true
+	switch payload := msg.Payload.(type) {
+	case *pb.ConferenceData_PrivateMessage:
+		s.handlePrivateMessage(room, client, payload.PrivateMessage)
+	case *pb.ConferenceData_AudioChunk:
+		if m := room.activeMixer(); m != nil {
+			// The mixer only understands PCM; Opus frames still in flight
+			// from before the switch to mix mode are dropped.
+			if payload.AudioChunk.GetCodec() == pb.AudioCodec_AUDIO_CODEC_PCM16 {
+				m.push(client, payload.AudioChunk.GetData())
+			}
+		} else if sel := room.activeSelector(); sel != nil {
+			room.forwardSelected(sel, msg, client)
+		} else {
+			room.Broadcast(msg, client)
 		}
-
-		log.Printf("Sending broadcast to %s (%s)", client.id, clientAddr)
-		select {
-		case client.ch <- msg:
-		default:
-			log.Printf("Dropped message for client %s, channel full.", client.id)
+	case *pb.ConferenceData_Command:
+		if payload.Command.GetType() == "AUDIO_MODE" {
+			s.handleAudioMode(room, client, payload.Command.GetValue())
+		} else {
+			room.Broadcast(msg, client)
 		}
-		return true
-	})
+	case *pb.ConferenceData_FileAnnouncement:
+		logger.Infof("File announcement from '%s' in room '%s' for '%s'", client.id, room.id, payload.FileAnnouncement.Filename)
+		s.activeTransfers.LoadOrStore(payload.FileAnnouncement.TransferId, s.newFileTransfer(payload.FileAnnouncement.TransferId))
+		room.Broadcast(msg, client)
+	case *pb.ConferenceData_Batch:
+		// Batches do not nest; the receive loop only unpacks one level.
+	case *pb.ConferenceData_Roster, *pb.ConferenceData_Error:
+		// Roster updates and errors are the server's to send.
+	default:
+		room.Broadcast(msg, client)
+	}
+}
+
+// --- Message Handling ---
+
+// Broadcast delivers msg to every client in the room except the sender
+// (nil for server-originated messages). The message is encoded once and the
+// bytes are shared by every recipient stream. Chat, commands and file
+// announcements are also sequenced into the room history.
+func (r *Room) Broadcast(msg *pb.ConferenceData, sender *Client) {
+	if sender != nil && broadcastLog.Enabled(levelDebug) {
+		broadcastLog.Debugf("Broadcasting message from %s (%s)", sender.id, sender.addr)
+	}
+	recorded := isHistory(msg)
+	if recorded {
+		// Held through fan-out so joiners, who join under the same lock,
+		// see each message exactly once.
+		r.history.mu.Lock()
+		defer r.history.mu.Unlock()
+	}
+	subs := r.clients.snapshot()
+	if len(subs.all) == 0 {
+		return
+	}
+	stampEnqueued(msg)
+	if recorded {
+		r.history.next(msg)
+	}
+	f, err := newFrame(msg)
+	if recorded {
+		r.history.record(f)
+	}
+	if err != nil {
+		logger.Errorf("Failed to encode broadcast in room '%s': %v", r.id, err)
+		return
+	}
+	start := time.Now()
+	subs.deliver(f, sender)
+	elapsed := time.Since(start)
+	metrics.broadcastDuration.observe(elapsed)
+	r.broadcasts.add(1)
+	r.broadcastNanos.add(uint64(elapsed))
 }
 
 func (s *server) handlePrivateMessage(room *Room, sender *Client, pm *pb.PrivateMessage) {
 	recipientID := pm.RecipientId
-	if val, ok := room.users.Load(recipientID); ok {
-		recipient := val.(*Client)
-		
-		// Format the private message as a standard ChatMessage for the recipient
-		privateContent := fmt.Sprintf("(private from %s) %s", sender.id, pm.Content)
-		fwdMsg := &pb.ConferenceData{
-			RoomId: room.id,
-			Sender: sender.id,
-			Payload: &pb.ConferenceData_TextMessage{
-				TextMessage: &pb.ChatMessage{
-					Sender: sender.id,
-					Content: privateContent,
-					RoomId: room.id,
-					Timestamp: time.Now().Unix(),
-				},
-			},
+	if recipient, ok := room.Lookup(recipientID); ok {
+		// Delivered to the recipient only; the header names the sender
+		if !recipient.enqueue(privateFrame(sender.pid, pm.Content, time.Now().Unix())) {
+			dropLog.Warnf("Dropped private message from '%s' for '%s', lane full.", sender.id, recipient.id)
+			return
 		}
-		recipient.ch <- fwdMsg
-		log.Printf("Relayed private message from '%s' to '%s'", sender.id, recipient.id)
+		logger.Debugf("Relayed private message from '%s' to '%s'", sender.id, recipient.id)
 	} else {
 		// Send "user not found" error back to the sender
-		notFoundMsg := &pb.ConferenceData{
-			Sender: "Server",
-			Payload: &pb.ConferenceData_Command{
-				Command: &pb.Command{Type: "ERROR", Value: fmt.Sprintf("User '%s' not found in this room.", recipientID)},
-			},
-		}
-		sender.ch <- notFoundMsg
-		log.Printf("Failed to send private message from '%s': user '%s' not found.", sender.id, recipientID)
+		sender.enqueue(serverFrame(serverError(pb.ErrorCode_ERROR_USER_NOT_FOUND, false,
+			fmt.Sprintf("User '%s' not found in this room.", recipientID))))
+		logger.Infof("Failed to send private message from '%s': user '%s' not found.", sender.id, recipientID)
+	}
+}
+
+// serverError builds an error addressed to a single client; fatal means the
+// server closes the stream right after.
+func serverError(code pb.ErrorCode, fatal bool, message string) *pb.ConferenceData {
+	return &pb.ConferenceData{
+		Sender: "Server",
+		Payload: &pb.ConferenceData_Error{Error: &pb.ServerError{Code: code, Message: message, Fatal: fatal}},
 	}
 }
 
 // --- Room Helpers ---
 func (r *Room) IsEmpty() bool {
-	count := 0
-	r.clients.Range(func(_, _ interface{}) bool {
-		count++
-		return false // Stop after finding one
-	})
-	return count == 0
+	return len(r.clients.snapshot().all) == 0
 }
 
 
 // --- File Transfer (Unchanged from previous step, but placed here for completeness) ---
 
-type transfer interface { isTransfer() }
-type p2pTransfer struct { sender pb.ConferenceService_TransferFileServer; receiver pb.ConferenceService_TransferFileServer; mu sync.Mutex }
-func (t *p2pTransfer) isTransfer() {}
-type broadcastTransfer struct { sender pb.ConferenceService_TransferFileServer; receivers sync.Map; mu sync.Mutex }
-func (t *broadcastTransfer) isTransfer() {}
-
-func (s *server) RequestFileTransfer(ctx context.Context, req *pb.FileTransferRequest) (*pb.FileTransferResponse, error) {
-	log.Printf("P2P file request from '%s' to '%s' for file '%s'", req.Sender, req.Recipient, req.Filename)
-	respChan := make(chan *pb.FileTransferResponse, 1)
-	s.transferMu.Lock()
-	s.transferResponses[req.TransferId] = respChan
-	s.transferMu.Unlock()
-	defer func() { s.transferMu.Lock(); delete(s.transferResponses, req.TransferId); s.transferMu.Unlock() }()
-	notificationMsg := &pb.ConferenceData{
-		RoomId: req.RoomId, Sender: "Sistema-FileTransfer",
-		Payload: &pb.ConferenceData_TextMessage{ TextMessage: &pb.ChatMessage{ Content: fmt.Sprintf("FILE_REQUEST:%s:%s:%s:%d:%d", req.TransferId, req.Sender, req.Filename, req.FileSize, req.Timestamp) } },
-	}
-	if r, ok := s.rooms.Load(req.RoomId); ok { r.(*Room).Broadcast(notificationMsg, "") }
-	select {
-	case resp := <-respChan:
-		if resp.Accepted { s.activeTransfers.Store(req.TransferId, &p2pTransfer{}) }
-		return resp, nil
-	case <-time.After(60 * time.Second):
-		return &pb.FileTransferResponse{TransferId: req.TransferId, Accepted: false}, nil
-	}
-}
-func (s *server) RespondFileTransfer(ctx context.Context, resp *pb.FileTransferResponse) (*pb.FileTransferResponse, error) {
-	s.transferMu.Lock()
-	respChan, ok := s.transferResponses[resp.TransferId]
-	s.transferMu.Unlock()
-	if !ok { return nil, fmt.Errorf("invalid transfer ID") }
-	respChan <- resp
-	return resp, nil
-}
+
 func (s *server) TransferFile(stream pb.ConferenceService_TransferFileServer) error {
 	md, _ := metadata.FromIncomingContext(stream.Context())
-	tID := md.Get("transfer-id")[0]; role := md.Get("role")[0]
-	p, _ := peer.FromContext(stream.Context()); clientAddr := p.Addr.String()
-	val, ok := s.activeTransfers.Load(tID)
-	if !ok { return fmt.Errorf("transfer not initiated") }
-	switch tx := val.(type) {
-	case *p2pTransfer: return s.handleP2PTransfer(tx, stream, role, tID)
-	case *broadcastTransfer: return s.handleBroadcastTransfer(tx, stream, role, clientAddr, tID)
-	default: return fmt.Errorf("unknown transfer type")
+	if owner := s.cluster.route(stream.Context(), firstValue(md, transferRoomIDKey)); owner != nil {
+		return s.cluster.proxyTransfer(owner, stream)
 	}
-}
-func (s *server) handleP2PTransfer(tx *p2pTransfer, stream pb.ConferenceService_TransferFileServer, role, tID string) error {
-	if role == "sender" {
-		tx.mu.Lock(); tx.sender = stream; receiver := tx.receiver; tx.mu.Unlock()
-		if receiver != nil { go s.proxyP2PChunks(tx.sender, receiver, tID) }
-	} else if role == "receiver" {
-		tx.mu.Lock(); tx.receiver = stream; sender := tx.sender; tx.mu.Unlock()
-		if sender != nil { go s.proxyP2PChunks(sender, tx.receiver, tID) }
-	}
-	<-stream.Context().Done()
-	return nil
-}
-func (s *server) handleBroadcastTransfer(tx *broadcastTransfer, stream pb.ConferenceService_TransferFileServer, role, clientAddr, tID string) error {
-	if role == "sender" {
-		tx.mu.Lock()
-		if tx.sender != nil { tx.mu.Unlock(); return fmt.Errorf("broadcast sender for '%s' already exists", tID) }
-		tx.sender = stream
-		tx.mu.Unlock()
-		s.proxyBroadcastChunks(tx, tID)
-	} else if role == "receiver" {
-		tx.receivers.Store(clientAddr, stream)
-		defer tx.receivers.Delete(clientAddr)
-	}
-	<-stream.Context().Done()
-	return nil
-}
-func (s *server) proxyP2PChunks(sender pb.ConferenceService_TransferFileServer, receiver pb.ConferenceService_TransferFileServer, tID string) {
-	for {
-		chunk, err := sender.Recv()
-		if err != nil { return }
-		if err := receiver.Send(chunk); err != nil { return }
+	tID, role := firstValue(md, "transfer-id"), firstValue(md, "role")
+	val, ok := s.activeTransfers.Load(tID)
+	if !ok { return status.Errorf(codes.NotFound, "transfer not initiated") }
+	tx := val.(*fileTransfer)
+	tx.streams.Add(1)
+	defer tx.streams.Add(-1)
+	tx.touch()
+	rg, err := parseChunkRange(firstValue(md, "chunk-range"))
+	if err != nil { return err }
+	switch role {
+	case "sender":
+		return s.handleTransferSender(tx, stream, rg)
+	case "receiver":
+		// resume-from is the first chunk_number the receiver still needs.
+		from, _ := strconv.Atoi(firstValue(md, "resume-from"))
+		return s.handleTransferReceiver(tx, stream, int32(max(from, 0)), rg)
 	}
+	return status.Errorf(codes.InvalidArgument, "unknown role '%s'", role)
 }
-func (s *server) proxyBroadcastChunks(tx *broadcastTransfer, tID string) {
-	defer s.activeTransfers.Delete(tID)
-	for {
-		chunk, err := tx.sender.Recv()
-		if err != nil { return }
-		tx.receivers.Range(func(key, value interface{}) bool {
-			receiverStream := value.(pb.ConferenceService_TransferFileServer)
-			if err := receiverStream.Send(chunk); err != nil { tx.receivers.Delete(key) }
-			return true
-		})
-		if chunk.GetIsLast() { return }
-	}
+func firstValue(md metadata.MD, key string) string {
+	if v := md.Get(key); len(v) > 0 { return v[0] }
+	return ""
 }
 
 // --- Main ---
 func main() {
-	lis, err := net.Listen("tcp", ":50051")
-	if err != nil { log.Fatalf("Failed to listen: %v", err) }
-	s := grpc.NewServer()
-	pb.RegisterConferenceServiceServer(s, newServer())
-	log.Printf("Server listening at %v", lis.Addr())
-	if err := s.Serve(lis); err != nil { log.Fatalf("Failed to serve: %v", err) }
+	lis, err := net.Listen("tcp", ":"+strconv.Itoa(envInt("GRPC_PORT", 50051)))
+	if err != nil { logger.Fatalf("Failed to listen: %v", err) }
+	chunks, err := newChunkStore(chunkStoreConfig())
+	if err != nil { logger.Fatalf("Failed to open chunk store: %v", err) }
+	cl, err := clusterFromEnv()
+	if err != nil { logger.Fatalf("Invalid cluster configuration: %v", err) }
+	if cl != nil { logger.Infof("Cluster node %s of %d", cl.self, len(cl.nodes)) }
+	startDebugServer()
+	startMetricsServer()
+	s := grpc.NewServer(grpc.ForceServerCodec(frameCodec{}),
+		grpc.ChainUnaryInterceptor(cl.unaryMesh, unaryMetrics), grpc.ChainStreamInterceptor(cl.streamMesh, streamMetrics))
+	srv := newServer(chunks, cl)
+	pb.RegisterConferenceServiceServer(s, srv)
+	go srv.drainOnSignal(s)
+	logger.Infof("Server listening at %v", lis.Addr())
+	if err := s.Serve(lis); err != nil { logger.Fatalf("Failed to serve: %v", err) }
+	logger.Infof("Server stopped")
+	logger.Close()
 }
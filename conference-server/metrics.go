@@ -0,0 +1,449 @@
+package main
+
+import (
+	"bufio"
+	"context"
+	"fmt"
+	"net/http"
+	"os"
+	"path"
+	"sort"
+	"strconv"
+	"strings"
+	"sync"
+	"sync/atomic"
+	"time"
+
+	"google.golang.org/grpc"
+	"google.golang.org/grpc/peer"
+	"google.golang.org/grpc/status"
+
+	pb "conference-server/conference"
+)
+
+// --- Metrics ---
+//
+// With METRICS_ADDR set (e.g. :9090) the server serves Prometheus text
+// metrics on /metrics. Hot-path counters are plain atomics updated in place;
+// room, client and transfer gauges are gathered from live state on each
+// scrape, so they cost nothing between scrapes. Per-room and per-client
+// series are what point at the room or client behind a latency spike.
+//
+// gRPC interceptors time every call by method and status code, count stream
+// messages by payload type and file-transfer bytes, and log unary calls
+// slower than SLOW_CALL_MS together with their room and peer.
+
+var (
+	slowCallThreshold = time.Duration(envInt("SLOW_CALL_MS", 500)) * time.Millisecond
+	// A transfer with open streams that moves no chunk for this long is stalled.
+	transferStallTimeout = time.Duration(envInt("FILE_STALL_TIMEOUT", 30)) * time.Second
+)
+
+// latencyBuckets are histogram upper bounds in seconds, from 100 µs
+// (a small-room broadcast) to a minute (a long unary call).
+var latencyBuckets = []float64{0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10, 30, 60}
+
+type counter struct{ v atomic.Uint64 }
+
+func (c *counter) add(n uint64) { c.v.Add(n) }
+func (c *counter) load() uint64 { return c.v.Load() }
+
+type histogram struct {
+	bounds   []float64
+	counts   []atomic.Uint64 // counts[i] observed <= bounds[i]; the last is +Inf
+	sumNanos atomic.Uint64
+}
+
+func newHistogram() *histogram {
+	return &histogram{bounds: latencyBuckets, counts: make([]atomic.Uint64, len(latencyBuckets)+1)}
+}
+
+func (h *histogram) observe(d time.Duration) {
+	h.counts[sort.SearchFloat64s(h.bounds, d.Seconds())].Add(1)
+	h.sumNanos.Add(uint64(max(d, 0)))
+}
+
+// histogramVec holds one histogram per label set, created on first use.
+type histogramVec struct {
+	mu sync.RWMutex
+	m  map[string]*histogram // by rendered label set
+}
+
+func (v *histogramVec) with(labels string) *histogram {
+	v.mu.RLock()
+	h, ok := v.m[labels]
+	v.mu.RUnlock()
+	if ok {
+		return h
+	}
+	v.mu.Lock()
+	defer v.mu.Unlock()
+	if h, ok = v.m[labels]; !ok {
+		if v.m == nil {
+			v.m = make(map[string]*histogram)
+		}
+		h = newHistogram()
+		v.m[labels] = h
+	}
+	return h
+}
+
+// payloadKind classifies ConferenceData payloads, for frames and metrics.
+type payloadKind uint8
+
+const (
+	kindText payloadKind = iota
+	kindAudio
+	kindCommand
+	kindFileAnnouncement
+	kindPrivateMessage
+	kindFileOffer
+	kindFileResponse
+	kindBatch
+	kindRoster
+	kindError
+	kindOther
+)
+
+// payloadNames label ConferenceData payloads; the index is the payloadKind.
+var payloadNames = [...]string{"text", "audio", "command", "file_announcement", "private_message", "file_offer", "file_response", "batch", "roster", "error", "other"}
+
+func kindOf(msg *pb.ConferenceData) payloadKind {
+	switch msg.GetPayload().(type) {
+	case *pb.ConferenceData_TextMessage:
+		return kindText
+	case *pb.ConferenceData_AudioChunk:
+		return kindAudio
+	case *pb.ConferenceData_Command:
+		return kindCommand
+	case *pb.ConferenceData_FileAnnouncement:
+		return kindFileAnnouncement
+	case *pb.ConferenceData_PrivateMessage:
+		return kindPrivateMessage
+	case *pb.ConferenceData_FileOffer:
+		return kindFileOffer
+	case *pb.ConferenceData_FileResponse:
+		return kindFileResponse
+	case *pb.ConferenceData_Batch:
+		return kindBatch
+	case *pb.ConferenceData_Roster:
+		return kindRoster
+	case *pb.ConferenceData_Error:
+		return kindError
+	}
+	return kindOther
+}
+
+type serverMetrics struct {
+	messagesIn, messagesOut [len(payloadNames)]counter
+	droppedReliable         counter
+	droppedAudio            counter
+	broadcastDuration       *histogram
+	tracedLatency           *histogram
+	transferBytesIn         counter
+	transferBytesOut        counter
+	batchedIn, batchedOut   counter // frames carried inside batches
+	evictedClients          counter
+
+	unaryDuration  histogramVec
+	streamDuration histogramVec
+	streamsMu      sync.Mutex
+	streamsActive  map[string]int // by method
+
+	collectMu  sync.Mutex
+	collectors []func(w *metricsWriter)
+}
+
+var metrics = &serverMetrics{broadcastDuration: newHistogram(), tracedLatency: newHistogram(), streamsActive: make(map[string]int)}
+
+// collect registers a function that writes scrape-time metrics.
+func (m *serverMetrics) collect(f func(w *metricsWriter)) {
+	m.collectMu.Lock()
+	m.collectors = append(m.collectors, f)
+	m.collectMu.Unlock()
+}
+
+// --- Exposition ---
+
+type metricsWriter struct {
+	w *bufio.Writer
+}
+
+func (w *metricsWriter) family(name, kind, help string) {
+	fmt.Fprintf(w.w, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, kind)
+}
+
+func (w *metricsWriter) sample(name, labels string, v float64) {
+	w.w.WriteString(name)
+	w.w.WriteString(labels)
+	w.w.WriteByte(' ')
+	w.w.WriteString(strconv.FormatFloat(v, 'g', -1, 64))
+	w.w.WriteByte('\n')
+}
+
+func (w *metricsWriter) histogram(name, labels string, h *histogram) {
+	inner := strings.TrimSuffix(strings.TrimPrefix(labels, "{"), "}")
+	if inner != "" {
+		inner += ","
+	}
+	var cumulative uint64
+	for i := range h.counts {
+		cumulative += h.counts[i].Load()
+		le := "+Inf"
+		if i < len(h.bounds) {
+			le = strconv.FormatFloat(h.bounds[i], 'g', -1, 64)
+		}
+		w.sample(name+"_bucket", "{"+inner+`le="`+le+`"}`, float64(cumulative))
+	}
+	w.sample(name+"_sum", labels, float64(h.sumNanos.Load())/1e9)
+	w.sample(name+"_count", labels, float64(cumulative))
+}
+
+func (w *metricsWriter) histogramVec(name string, v *histogramVec) {
+	v.mu.RLock()
+	keys := make([]string, 0, len(v.m))
+	for k := range v.m {
+		keys = append(keys, k)
+	}
+	v.mu.RUnlock()
+	sort.Strings(keys)
+	for _, k := range keys {
+		w.histogram(name, k, v.with(k))
+	}
+}
+
+var labelEscaper = strings.NewReplacer(`\`, `\\`, `"`, `\"`, "\n", `\n`)
+
+// labels renders name/value pairs as a Prometheus label set.
+func labels(kv ...string) string {
+	var b strings.Builder
+	b.WriteByte('{')
+	for i := 0; i+1 < len(kv); i += 2 {
+		if i > 0 {
+			b.WriteByte(',')
+		}
+		b.WriteString(kv[i])
+		b.WriteString(`="`)
+		labelEscaper.WriteString(&b, kv[i+1])
+		b.WriteByte('"')
+	}
+	b.WriteByte('}')
+	return b.String()
+}
+
+func (m *serverMetrics) write(w *metricsWriter) {
+	w.family("conference_messages_received_total", "counter", "ConferenceData messages received from clients, by payload.")
+	for i, name := range payloadNames {
+		w.sample("conference_messages_received_total", labels("payload", name), float64(m.messagesIn[i].load()))
+	}
+	w.family("conference_messages_sent_total", "counter", "ConferenceData messages written to client streams, by payload.")
+	for i, name := range payloadNames {
+		w.sample("conference_messages_sent_total", labels("payload", name), float64(m.messagesOut[i].load()))
+	}
+	w.family("conference_batched_frames_total", "counter", "Frames carried inside ConferenceBatch messages, received (in) and sent (out).")
+	w.sample("conference_batched_frames_total", labels("direction", "in"), float64(m.batchedIn.load()))
+	w.sample("conference_batched_frames_total", labels("direction", "out"), float64(m.batchedOut.load()))
+	w.family("conference_messages_dropped_total", "counter", "Messages dropped because a client lane was full.")
+	w.sample("conference_messages_dropped_total", labels("lane", "reliable"), float64(m.droppedReliable.load()))
+	w.sample("conference_messages_dropped_total", labels("lane", "audio"), float64(m.droppedAudio.load()))
+	w.family("conference_clients_evicted_total", "counter", "Clients disconnected for dropping more than SLOW_CLIENT_MAX_DROPS messages.")
+	w.sample("conference_clients_evicted_total", "", float64(m.evictedClients.load()))
+	w.family("conference_broadcast_duration_seconds", "histogram", "Time to fan one message out to a room.")
+	w.histogram("conference_broadcast_duration_seconds", "", m.broadcastDuration)
+	w.family("conference_traced_message_server_seconds", "histogram", "Time from receiving a traced message to writing it to a recipient's stream.")
+	w.histogram("conference_traced_message_server_seconds", "", m.tracedLatency)
+	w.family("conference_file_transfer_bytes_total", "counter", "File chunk bytes received from senders (in) and sent to receivers (out).")
+	w.sample("conference_file_transfer_bytes_total", labels("direction", "in"), float64(m.transferBytesIn.load()))
+	w.sample("conference_file_transfer_bytes_total", labels("direction", "out"), float64(m.transferBytesOut.load()))
+
+	w.family("conference_grpc_unary_duration_seconds", "histogram", "Unary call latency by method and status code.")
+	w.histogramVec("conference_grpc_unary_duration_seconds", &m.unaryDuration)
+	w.family("conference_grpc_stream_duration_seconds", "histogram", "Stream lifetime by method and status code.")
+	w.histogramVec("conference_grpc_stream_duration_seconds", &m.streamDuration)
+	w.family("conference_grpc_streams_active", "gauge", "Open streams by method.")
+	m.streamsMu.Lock()
+	methods := make([]string, 0, len(m.streamsActive))
+	for method := range m.streamsActive {
+		methods = append(methods, method)
+	}
+	sort.Strings(methods)
+	for _, method := range methods {
+		w.sample("conference_grpc_streams_active", labels("method", method), float64(m.streamsActive[method]))
+	}
+	m.streamsMu.Unlock()
+
+	m.collectMu.Lock()
+	collectors := m.collectors
+	m.collectMu.Unlock()
+	for _, f := range collectors {
+		f(w)
+	}
+}
+
+func (m *serverMetrics) ServeHTTP(rw http.ResponseWriter, r *http.Request) {
+	rw.Header().Set("Content-Type", "text/plain; version=0.0.4; charset=utf-8")
+	w := &metricsWriter{w: bufio.NewWriter(rw)}
+	m.write(w)
+	w.w.Flush()
+}
+
+func startMetricsServer() {
+	addr := os.Getenv("METRICS_ADDR")
+	if addr == "" {
+		return
+	}
+	mux := http.NewServeMux()
+	mux.Handle("/metrics", metrics)
+	go func() {
+		logger.Infof("Metrics listening at %s/metrics", addr)
+		if err := http.ListenAndServe(addr, mux); err != nil {
+			logger.Errorf("Metrics endpoint stopped: %v", err)
+		}
+	}()
+}
+
+// --- Scrape-time state ---
+
+// collectState reports rooms, clients, lane depths and transfers.
+func (s *server) collectState(w *metricsWriter) {
+	type roomRow struct {
+		room    *Room
+		clients []*Client
+	}
+	var rows []roomRow
+	s.rooms.Range(func(_, v any) bool {
+		room := v.(*Room)
+		rows = append(rows, roomRow{room, room.clients.snapshot().all})
+		return true
+	})
+	sort.Slice(rows, func(i, j int) bool { return rows[i].room.id < rows[j].room.id })
+
+	total := 0
+	for _, row := range rows {
+		total += len(row.clients)
+	}
+	w.family("conference_rooms", "gauge", "Active rooms.")
+	w.sample("conference_rooms", "", float64(len(rows)))
+	w.family("conference_clients", "gauge", "Connected clients.")
+	w.sample("conference_clients", "", float64(total))
+
+	w.family("conference_room_clients", "gauge", "Connected clients per room.")
+	for _, row := range rows {
+		w.sample("conference_room_clients", labels("room", row.room.id), float64(len(row.clients)))
+	}
+	w.family("conference_room_broadcasts_total", "counter", "Messages fanned out per room.")
+	for _, row := range rows {
+		w.sample("conference_room_broadcasts_total", labels("room", row.room.id), float64(row.room.broadcasts.load()))
+	}
+	w.family("conference_room_broadcast_seconds_total", "counter", "Time spent fanning out per room.")
+	for _, row := range rows {
+		w.sample("conference_room_broadcast_seconds_total", labels("room", row.room.id), float64(row.room.broadcastNanos.load())/1e9)
+	}
+	w.family("conference_client_queue_depth", "gauge", "Frames waiting on a client's lanes.")
+	for _, row := range rows {
+		for _, c := range row.clients {
+			w.sample("conference_client_queue_depth", labels("room", row.room.id, "client", c.id, "lane", "reliable"), float64(len(c.ch)))
+			w.sample("conference_client_queue_depth", labels("room", row.room.id, "client", c.id, "lane", "audio"), float64(c.audio.len()))
+		}
+	}
+	w.family("conference_client_dropped_total", "counter", "Frames dropped for a client because its lane was full.")
+	for _, row := range rows {
+		for _, c := range row.clients {
+			w.sample("conference_client_dropped_total", labels("room", row.room.id, "client", c.id, "lane", "reliable"), float64(c.dropped.load()))
+			w.sample("conference_client_dropped_total", labels("room", row.room.id, "client", c.id, "lane", "audio"), float64(c.audio.droppedCount()))
+		}
+	}
+
+	active, stalled := 0, 0
+	now := time.Now().UnixNano()
+	s.activeTransfers.Range(func(_, v any) bool {
+		tx := v.(*fileTransfer)
+		if tx.streams.Load() > 0 {
+			active++
+			if time.Duration(now-tx.lastActivity.Load()) > transferStallTimeout {
+				stalled++
+			}
+		}
+		return true
+	})
+	w.family("conference_file_transfers_active", "gauge", "Transfers with at least one open TransferFile stream.")
+	w.sample("conference_file_transfers_active", "", float64(active))
+	w.family("conference_file_transfers_stalled", "gauge", "Active transfers that moved no chunk within FILE_STALL_TIMEOUT.")
+	w.sample("conference_file_transfers_stalled", "", float64(stalled))
+}
+
+// --- Interceptors ---
+
+type roomRequest interface {
+	GetRoomId() string
+	GetSender() string
+}
+
+func unaryMetrics(ctx context.Context, req any, info *grpc.UnaryServerInfo, handler grpc.UnaryHandler) (any, error) {
+	start := time.Now()
+	resp, err := handler(ctx, req)
+	elapsed := time.Since(start)
+	method := path.Base(info.FullMethod)
+	metrics.unaryDuration.with(labels("method", method, "code", status.Code(err).String())).observe(elapsed)
+	if elapsed > slowCallThreshold {
+		room, sender := "", ""
+		if r, ok := req.(roomRequest); ok {
+			room, sender = r.GetRoomId(), r.GetSender()
+		}
+		addr := ""
+		if p, ok := peer.FromContext(ctx); ok {
+			addr = p.Addr.String()
+		}
+		logger.Warnf("Slow %s call: %v (room '%s', sender '%s', peer %s)", method, elapsed.Round(time.Millisecond), room, sender, addr)
+	}
+	return resp, err
+}
+
+func streamMetrics(srv any, ss grpc.ServerStream, info *grpc.StreamServerInfo, handler grpc.StreamHandler) error {
+	method := path.Base(info.FullMethod)
+	metrics.streamsMu.Lock()
+	metrics.streamsActive[method]++
+	metrics.streamsMu.Unlock()
+	start := time.Now()
+	err := handler(srv, meteredStream{ss})
+	metrics.streamDuration.with(labels("method", method, "code", status.Code(err).String())).observe(time.Since(start))
+	metrics.streamsMu.Lock()
+	metrics.streamsActive[method]--
+	metrics.streamsMu.Unlock()
+	return err
+}
+
+// meteredStream counts the messages and file bytes crossing a stream.
+type meteredStream struct {
+	grpc.ServerStream
+}
+
+func (s meteredStream) RecvMsg(m any) error {
+	err := s.ServerStream.RecvMsg(m)
+	if err == nil {
+		switch m := m.(type) {
+		case *pb.ConferenceData:
+			metrics.messagesIn[kindOf(m)].add(1)
+		case *pb.FileChunk:
+			metrics.transferBytesIn.add(uint64(len(m.GetData())))
+		}
+	}
+	return err
+}
+
+func (s meteredStream) SendMsg(m any) error {
+	err := s.ServerStream.SendMsg(m)
+	if err == nil {
+		switch m := m.(type) {
+		case *frame:
+			metrics.messagesOut[m.kind].add(1)
+		case *pb.ConferenceData:
+			metrics.messagesOut[kindOf(m)].add(1)
+		case *chunkFrame:
+			metrics.transferBytesOut.add(uint64(len(m.data)))
+		case *pb.FileChunk:
+			metrics.transferBytesOut.add(uint64(len(m.GetData())))
+		}
+	}
+	return err
+}
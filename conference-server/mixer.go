@@ -0,0 +1,333 @@
+package main
+
+import (
+	"encoding/binary"
+	"os"
+	"strings"
+	"sync"
+	"time"
+
+	pb "conference-server/conference"
+)
+
+// --- Server-side audio mixing (MCU mode) ---
+//
+// In relay mode (the default) every AudioChunk is forwarded to every other
+// participant, so each listener receives N-1 streams. In mix mode the room
+// runs a mixer instead: inputs are jitter-buffered per sender, summed once per
+// 20 ms tick, and each listener receives a single stream. Speakers get the mix
+// minus their own contribution; everybody else shares one encoded frame.
+//
+// The mixer works on the clients' capture format: 48 kHz, 16-bit signed
+// little-endian mono PCM (AUDIO_CODEC_PCM16).
+
+type audioMode int32
+
+const (
+	audioRelay audioMode = iota
+	audioMix
+	audioSelect
+)
+
+func (m audioMode) String() string {
+	switch m {
+	case audioMix:
+		return "mix"
+	case audioSelect:
+		return "select"
+	}
+	return "relay"
+}
+
+func parseAudioMode(s string) (audioMode, bool) {
+	switch strings.ToLower(strings.TrimSpace(s)) {
+	case "relay", "":
+		return audioRelay, true
+	case "mix", "mcu":
+		return audioMix, true
+	case "select", "sfu":
+		return audioSelect, true
+	}
+	return audioRelay, false
+}
+
+// defaultAudioMode applies to newly created rooms (AUDIO_MODE=relay|mix|select).
+var defaultAudioMode = func() audioMode {
+	mode, ok := parseAudioMode(os.Getenv("AUDIO_MODE"))
+	if !ok {
+		logger.Warnf("Unknown AUDIO_MODE %q, using relay", os.Getenv("AUDIO_MODE"))
+	}
+	return mode
+}()
+
+const (
+	mixSampleRate   = 48000
+	mixFrameMs      = 20
+	mixFrameSamples = mixSampleRate * mixFrameMs / 1000
+	// Each input buffers up to 200 ms; the oldest samples are discarded beyond
+	// that so a bursty sender cannot build up latency.
+	mixInputCapacity = mixFrameSamples * 10
+	// An input starts (and restarts after an underrun) once 40 ms are queued.
+	mixPrefill = mixFrameSamples * 2
+)
+
+const mixerSender = "Mixer"
+
+// mixInput is one sender's jitter buffer: a ring of samples waiting to be
+// mixed, plus the frame taken from it on the current tick.
+type mixInput struct {
+	ring    [mixInputCapacity]int16
+	head    int
+	n       int
+	primed  bool
+	contrib [mixFrameSamples]int32
+}
+
+func (in *mixInput) write(pcm []byte) {
+	for i := 0; i+1 < len(pcm); i += 2 {
+		sample := int16(binary.LittleEndian.Uint16(pcm[i:]))
+		if in.n == mixInputCapacity {
+			in.head = (in.head + 1) % mixInputCapacity
+			in.n--
+		}
+		in.ring[(in.head+in.n)%mixInputCapacity] = sample
+		in.n++
+	}
+}
+
+// take moves the next frame into contrib and reports whether the input
+// contributed anything this tick.
+func (in *mixInput) take() bool {
+	if !in.primed {
+		if in.n < mixPrefill {
+			return false
+		}
+		in.primed = true
+	}
+	if in.n < mixFrameSamples {
+		// Underrun: play out what is left and buffer up again.
+		in.primed = false
+		if in.n == 0 {
+			return false
+		}
+	}
+	count := min(in.n, mixFrameSamples)
+	for i := 0; i < count; i++ {
+		in.contrib[i] = int32(in.ring[(in.head+i)%mixInputCapacity])
+	}
+	for i := count; i < mixFrameSamples; i++ {
+		in.contrib[i] = 0
+	}
+	in.head = (in.head + count) % mixInputCapacity
+	in.n -= count
+	return true
+}
+
+type mixer struct {
+	room *Room
+	mu   sync.Mutex
+	ins  map[*Client]*mixInput
+	stop chan struct{}
+	done chan struct{}
+	mix  [mixFrameSamples]int32
+	seq  uint32
+
+	audio    *audioTemplate     // encodes the mixed frames, see wire.go
+	speakers map[*Client]*frame // reused by tick, which only the run goroutine calls
+}
+
+func newMixer(room *Room) *mixer {
+	m := &mixer{
+		room: room,
+		ins:  make(map[*Client]*mixInput),
+		stop: make(chan struct{}),
+		done: make(chan struct{}),
+
+		audio:    newAudioTemplate(room.id, mixerSender, mixFrameSamples*2, mixFrameMs),
+		speakers: make(map[*Client]*frame),
+	}
+	go m.run()
+	return m
+}
+
+// push queues a sender's PCM on its jitter buffer.
+func (m *mixer) push(c *Client, pcm []byte) {
+	m.mu.Lock()
+	in, ok := m.ins[c]
+	if !ok {
+		in = &mixInput{}
+		m.ins[c] = in
+	}
+	in.write(pcm)
+	m.mu.Unlock()
+}
+
+// remove drops a departed client's input.
+func (m *mixer) remove(c *Client) {
+	m.mu.Lock()
+	delete(m.ins, c)
+	m.mu.Unlock()
+}
+
+func (m *mixer) close() {
+	close(m.stop)
+	<-m.done
+}
+
+func (m *mixer) run() {
+	defer close(m.done)
+	ticker := time.NewTicker(mixFrameMs * time.Millisecond)
+	defer ticker.Stop()
+	for {
+		select {
+		case <-m.stop:
+			return
+		case <-ticker.C:
+			m.tick()
+		}
+	}
+}
+
+// tick mixes one frame and queues it on every listener's audio lane.
+func (m *mixer) tick() {
+	speakers := m.speakers
+	defer clear(speakers)
+
+	m.mu.Lock()
+	clear(m.mix[:])
+	for c, in := range m.ins {
+		if in.take() {
+			speakers[c] = nil
+			addFrame(&m.mix, &in.contrib)
+		}
+	}
+	if len(speakers) == 0 {
+		m.mu.Unlock()
+		return
+	}
+	m.seq++
+	seq := m.seq
+	// Mix-minus for each speaker, so nobody hears themselves.
+	for c := range speakers {
+		f, pcm := m.audio.frame(seq)
+		mixMinus(pcm, &m.mix, &m.ins[c].contrib)
+		speakers[c] = f
+	}
+	shared, pcm := m.audio.frame(seq)
+	mixDown(pcm, &m.mix)
+	m.mu.Unlock()
+
+	for _, listener := range m.room.clients.snapshot().all {
+		f, isSpeaker := speakers[listener]
+		if !isSpeaker {
+			f = shared
+		}
+		listener.enqueue(f)
+	}
+}
+
+// The mixing kernels below work on fixed-size arrays with no branches in the
+// loop bodies (min/max compile to conditional moves), which lets the compiler
+// drop bounds checks and keeps them friendly to auto-vectorisation. Sums are
+// accumulated in int32 and saturated to int16 once, on output.
+
+func addFrame(mix, in *[mixFrameSamples]int32) {
+	for i := range mix {
+		mix[i] += in[i]
+	}
+}
+
+func mixDown(dst []byte, mix *[mixFrameSamples]int32) {
+	_ = dst[2*mixFrameSamples-1]
+	for i, v := range mix {
+		binary.LittleEndian.PutUint16(dst[2*i:], uint16(saturate16(v)))
+	}
+}
+
+func mixMinus(dst []byte, mix, own *[mixFrameSamples]int32) {
+	_ = dst[2*mixFrameSamples-1]
+	for i, v := range mix {
+		binary.LittleEndian.PutUint16(dst[2*i:], uint16(saturate16(v-own[i])))
+	}
+}
+
+func saturate16(v int32) int16 {
+	return int16(max(-32768, min(32767, v)))
+}
+
+// --- Room audio mode ---
+
+// AudioMode reports whether the room is relaying, mixing or selecting audio.
+func (r *Room) AudioMode() audioMode {
+	r.audioMu.Lock()
+	defer r.audioMu.Unlock()
+	switch {
+	case r.mixer != nil:
+		return audioMix
+	case r.selector != nil:
+		return audioSelect
+	}
+	return audioRelay
+}
+
+// SetAudioMode starts or stops the room's mixer or speaker selector. It
+// reports whether the mode changed.
+func (r *Room) SetAudioMode(mode audioMode) bool {
+	r.audioMu.Lock()
+	defer r.audioMu.Unlock()
+	current := audioRelay
+	switch {
+	case r.mixer != nil:
+		current = audioMix
+	case r.selector != nil:
+		current = audioSelect
+	}
+	if mode == current {
+		return false
+	}
+	if r.mixer != nil {
+		r.mixer.close()
+		r.mixer = nil
+	}
+	r.selector = nil
+	switch mode {
+	case audioMix:
+		r.mixer = newMixer(r)
+	case audioSelect:
+		r.selector = newSpeakerSelector(selectorTopK)
+	}
+	return true
+}
+
+// activeMixer returns the room's mixer, or nil unless in mix mode.
+func (r *Room) activeMixer() *mixer {
+	r.audioMu.Lock()
+	defer r.audioMu.Unlock()
+	return r.mixer
+}
+
+// activeSelector returns the room's speaker selector, or nil unless in
+// select mode.
+func (r *Room) activeSelector() *speakerSelector {
+	r.audioMu.Lock()
+	defer r.audioMu.Unlock()
+	return r.selector
+}
+
+func (s *server) handleAudioMode(room *Room, client *Client, value string) {
+	mode, ok := parseAudioMode(value)
+	if !ok {
+		client.enqueue(serverFrame(serverError(pb.ErrorCode_ERROR_INVALID_ARGUMENT, false,
+			"Unknown audio mode '"+value+"' (use relay, mix or select)")))
+		return
+	}
+	if !room.SetAudioMode(mode) {
+		return
+	}
+	logger.Infof("Client '%s' switched room '%s' to %s audio", client.id, room.id, mode)
+	room.Broadcast(&pb.ConferenceData{
+		Sender: "Server", RoomId: room.id,
+		Payload: &pb.ConferenceData_Command{Command: &pb.Command{Type: "AUDIO_MODE", Value: mode.String()}},
+	}, nil)
+	room.refreshAudioCodec()
+}
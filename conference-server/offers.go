@@ -0,0 +1,254 @@
+package main
+
+import (
+	"context"
+	"sync"
+	"time"
+
+	"google.golang.org/grpc/codes"
+	"google.golang.org/grpc/status"
+
+	pb "conference-server/conference"
+)
+
+// --- P2P file offers ---
+//
+// RequestFileTransfer does not wait for the answer. It records an offer,
+// delivers a FileOffer to the recipient alone, and returns at once with
+// pending set; the decision reaches the sender later as a file_response on
+// its JoinConference stream. Each offer moves from pending to accepted,
+// rejected or expired exactly once, under its shard's lock. Expiry is driven
+// by a single timer wheel rather than one timer per offer.
+
+const (
+	offerTimeout = 60 * time.Second
+	offerShards  = 32
+	wheelTick    = time.Second
+	wheelSlots   = 64
+)
+
+const fileTransferSender = "Sistema-FileTransfer"
+
+type offerState int
+
+const (
+	offerPending offerState = iota
+	offerAccepted
+	offerRejected
+	offerExpired
+)
+
+type offerShard struct {
+	mu     sync.Mutex
+	offers map[string]*pb.FileTransferRequest // pending offers by transfer ID
+}
+
+// offerTable holds pending offers, sharded by transfer ID so concurrent
+// requests and answers rarely share a lock.
+type offerTable struct {
+	shards [offerShards]offerShard
+}
+
+func newOfferTable() *offerTable {
+	t := &offerTable{}
+	for i := range t.shards {
+		t.shards[i].offers = make(map[string]*pb.FileTransferRequest)
+	}
+	return t
+}
+
+func (t *offerTable) shard(transferID string) *offerShard {
+	// FNV-1a, inline to keep the lookup allocation-free.
+	h := uint32(2166136261)
+	for i := 0; i < len(transferID); i++ {
+		h ^= uint32(transferID[i])
+		h *= 16777619
+	}
+	return &t.shards[h%offerShards]
+}
+
+// add records a pending offer; it fails if the transfer ID is in use.
+func (t *offerTable) add(req *pb.FileTransferRequest) bool {
+	sh := t.shard(req.TransferId)
+	sh.mu.Lock()
+	defer sh.mu.Unlock()
+	if _, exists := sh.offers[req.TransferId]; exists {
+		return false
+	}
+	sh.offers[req.TransferId] = req
+	return true
+}
+
+// resolve takes a pending offer out of the table if allow accepts it. Only
+// the first resolution of an offer succeeds.
+func (t *offerTable) resolve(transferID string, allow func(*pb.FileTransferRequest) bool) (*pb.FileTransferRequest, bool) {
+	sh := t.shard(transferID)
+	sh.mu.Lock()
+	defer sh.mu.Unlock()
+	req, ok := sh.offers[transferID]
+	if !ok || (allow != nil && !allow(req)) {
+		return nil, false
+	}
+	delete(sh.offers, transferID)
+	return req, true
+}
+
+// --- Timer wheel ---
+
+type wheelEntry struct {
+	id     string
+	rounds int // full turns left before the entry is due
+}
+
+// timerWheel is a hashed timing wheel with wheelTick resolution. Entries are
+// never cancelled: fire must ignore IDs that have been resolved meanwhile.
+type timerWheel struct {
+	mu    sync.Mutex
+	slots [wheelSlots][]wheelEntry
+	pos   int
+	fire  func(id string)
+}
+
+func newTimerWheel(fire func(id string)) *timerWheel {
+	w := &timerWheel{fire: fire}
+	go w.run()
+	return w
+}
+
+func (w *timerWheel) schedule(id string, after time.Duration) {
+	ticks := max(1, int((after+wheelTick-1)/wheelTick))
+	w.mu.Lock()
+	slot := (w.pos + ticks) % wheelSlots
+	w.slots[slot] = append(w.slots[slot], wheelEntry{id: id, rounds: (ticks - 1) / wheelSlots})
+	w.mu.Unlock()
+}
+
+func (w *timerWheel) run() {
+	ticker := time.NewTicker(wheelTick)
+	defer ticker.Stop()
+	for range ticker.C {
+		w.advance()
+	}
+}
+
+func (w *timerWheel) advance() {
+	var due []string
+	w.mu.Lock()
+	w.pos = (w.pos + 1) % wheelSlots
+	keep := w.slots[w.pos][:0]
+	for _, e := range w.slots[w.pos] {
+		if e.rounds == 0 {
+			due = append(due, e.id)
+		} else {
+			e.rounds--
+			keep = append(keep, e)
+		}
+	}
+	clear(w.slots[w.pos][len(keep):])
+	w.slots[w.pos] = keep
+	w.mu.Unlock()
+	for _, id := range due {
+		w.fire(id)
+	}
+}
+
+// --- Handlers ---
+
+func (s *server) RequestFileTransfer(ctx context.Context, req *pb.FileTransferRequest) (*pb.FileTransferResponse, error) {
+	if owner := s.cluster.route(ctx, req.RoomId); owner != nil {
+		client, err := owner.conn()
+		if err != nil {
+			return nil, status.Errorf(codes.Unavailable, "%v", err)
+		}
+		return client.RequestFileTransfer(s.cluster.outgoing(ctx), req)
+	}
+	logger.Infof("P2P file request from '%s' to '%s' for file '%s'", req.Sender, req.Recipient, req.Filename)
+	r, ok := s.rooms.Load(req.RoomId)
+	if !ok {
+		return nil, status.Errorf(codes.NotFound, "room '%s' not found", req.RoomId)
+	}
+	recipient, ok := r.(*Room).Lookup(req.Recipient)
+	if !ok {
+		return nil, status.Errorf(codes.NotFound, "user '%s' is not in room '%s'", req.Recipient, req.RoomId)
+	}
+	if !s.offers.add(req) {
+		return nil, status.Errorf(codes.AlreadyExists, "transfer '%s' already offered", req.TransferId)
+	}
+	s.offerWheel.schedule(req.TransferId, offerTimeout)
+	offer := serverFrame(&pb.ConferenceData{
+		RoomId: req.RoomId, Sender: fileTransferSender,
+		Payload: &pb.ConferenceData_FileOffer{FileOffer: &pb.FileOffer{
+			TransferId: req.TransferId, Sender: req.Sender, Filename: req.Filename,
+			FileSize: req.FileSize, Timestamp: req.Timestamp, Compressions: req.Compressions,
+		}},
+	})
+	if !recipient.enqueue(offer) {
+		s.offers.resolve(req.TransferId, nil)
+		return nil, status.Errorf(codes.Unavailable, "user '%s' is not keeping up, try again later", req.Recipient)
+	}
+	return &pb.FileTransferResponse{
+		TransferId: req.TransferId, Sender: req.Sender, Recipient: req.Recipient, RoomId: req.RoomId, Pending: true,
+	}, nil
+}
+
+func (s *server) RespondFileTransfer(ctx context.Context, resp *pb.FileTransferResponse) (*pb.FileTransferResponse, error) {
+	if owner := s.cluster.route(ctx, resp.RoomId); owner != nil {
+		client, err := owner.conn()
+		if err != nil {
+			return nil, status.Errorf(codes.Unavailable, "%v", err)
+		}
+		return client.RespondFileTransfer(s.cluster.outgoing(ctx), resp)
+	}
+	req, ok := s.offers.resolve(resp.TransferId, func(req *pb.FileTransferRequest) bool {
+		return req.Recipient == resp.Sender
+	})
+	if !ok {
+		return nil, status.Errorf(codes.NotFound, "no pending offer '%s' for '%s'", resp.TransferId, resp.Sender)
+	}
+	state := offerRejected
+	if resp.Accepted {
+		state = offerAccepted
+		s.activeTransfers.LoadOrStore(req.TransferId, s.newFileTransfer(req.TransferId))
+	}
+	s.finishOffer(req, state, resp.Compressions)
+	return resp, nil
+}
+
+// expireOffer is the timer wheel callback.
+func (s *server) expireOffer(transferID string) {
+	if req, ok := s.offers.resolve(transferID, nil); ok {
+		s.finishOffer(req, offerExpired, nil)
+	}
+}
+
+// finishOffer tells the sender how its offer ended.
+func (s *server) finishOffer(req *pb.FileTransferRequest, state offerState, compressions []pb.FileCompression) {
+	logger.Infof("P2P file offer %s from '%s' to '%s' %s", req.TransferId, req.Sender, req.Recipient, state)
+	r, ok := s.rooms.Load(req.RoomId)
+	if !ok {
+		return
+	}
+	sender, ok := r.(*Room).Lookup(req.Sender)
+	if !ok {
+		return
+	}
+	sender.enqueue(serverFrame(&pb.ConferenceData{
+		RoomId: req.RoomId, Sender: fileTransferSender,
+		Payload: &pb.ConferenceData_FileResponse{FileResponse: &pb.FileTransferResponse{
+			TransferId: req.TransferId, Accepted: state == offerAccepted, Expired: state == offerExpired,
+			Sender: req.Recipient, Recipient: req.Sender, RoomId: req.RoomId, Compressions: compressions,
+		}},
+	}))
+}
+
+func (st offerState) String() string {
+	switch st {
+	case offerAccepted:
+		return "accepted"
+	case offerRejected:
+		return "rejected"
+	case offerExpired:
+		return "expired"
+	}
+	return "pending"
+}
@@ -0,0 +1,46 @@
+package main
+
+import (
+	pb "conference-server/conference"
+)
+
+// --- Participant IDs ---
+//
+// JoinConference fixes a client's name and room from its first message, so
+// later frames need not repeat them. Each client gets a small room-scoped
+// participant ID on join; WELCOME lists every participant's ID and name and
+// roster updates (presence.go) keep the others' tables current. Relayed
+// frames then carry only header.participant_id: whatever identity strings a
+// client puts on a frame are discarded, which also stops it from speaking as
+// someone else.
+
+// participant describes c for roster commands.
+func (c *Client) participant() *pb.Participant {
+	return &pb.Participant{Id: c.pid, Name: c.id}
+}
+
+// identify strips the per-frame identity strings from a frame c sent and
+// stamps it with c's participant ID. A frame that came without a header gets
+// c's spare one; like the envelope (see receive), it is only borrowed until
+// the frame has been handled.
+func (c *Client) identify(msg *pb.ConferenceData) {
+	msg.Sender, msg.RoomId = "", ""
+	if tm := msg.GetTextMessage(); tm != nil {
+		tm.Sender, tm.RoomId = "", ""
+	}
+	if msg.Header == nil {
+		c.header.Reset()
+		msg.Header = &c.header
+	}
+	msg.Header.ParticipantId = c.pid
+}
+
+// participants lists everyone in the room.
+func (r *Room) participants() []*pb.Participant {
+	subs := r.clients.snapshot().all
+	list := make([]*pb.Participant, len(subs))
+	for i, c := range subs {
+		list[i] = c.participant()
+	}
+	return list
+}
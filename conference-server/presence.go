@@ -0,0 +1,111 @@
+package main
+
+import (
+	"sync"
+	"time"
+
+	pb "conference-server/conference"
+)
+
+// --- Presence ---
+//
+// Joins and leaves are not announced one by one: with N people arriving
+// together that is N² messages. After the first change a room waits
+// PRESENCE_WINDOW_MS, then broadcasts one RosterUpdate with everyone who
+// joined, resumed under a new ID or left in the meantime. Someone who comes
+// and goes within the window is not mentioned at all. Joiners already get
+// the whole roster in WELCOME. Roster updates are kept in the room history,
+// so replayed messages from people who have since left still have a name.
+//
+// A participant's first message flushes the pending changes early, so no one
+// receives a frame from an ID they have not been told about.
+
+var presenceWindow = time.Duration(max(envInt("PRESENCE_WINDOW_MS", 200), 0)) * time.Millisecond
+
+// presence collects a room's pending roster changes.
+type presence struct {
+	mu        sync.Mutex
+	scheduled bool // a flush is pending
+	joined    []*Client
+	resumed   []*Client
+	left      []uint32
+
+	flushing sync.Mutex // keeps updates in the order their changes happened
+}
+
+// announceJoin queues c's arrival, or its return under a new participant ID
+// when resumed is set.
+func (r *Room) announceJoin(c *Client, resumed bool) {
+	p := &r.presence
+	p.mu.Lock()
+	if resumed {
+		p.resumed = append(p.resumed, c)
+	} else {
+		p.joined = append(p.joined, c)
+	}
+	r.schedulePresence()
+}
+
+// announceLeave queues c's departure. If the others have not heard of c
+// yet, they never will.
+func (r *Room) announceLeave(c *Client) {
+	p := &r.presence
+	p.mu.Lock()
+	if !c.announced.Load() {
+		p.joined, p.resumed = without(p.joined, c), without(p.resumed, c)
+		p.mu.Unlock()
+		return
+	}
+	p.left = append(p.left, c.pid)
+	r.schedulePresence()
+}
+
+// schedulePresence arms the flush and releases p.mu, which the caller holds.
+func (r *Room) schedulePresence() {
+	p := &r.presence
+	if presenceWindow == 0 {
+		p.mu.Unlock()
+		r.flushPresence()
+		return
+	}
+	if !p.scheduled {
+		p.scheduled = true
+		time.AfterFunc(presenceWindow, r.flushPresence)
+	}
+	p.mu.Unlock()
+}
+
+// flushPresence broadcasts the pending changes, if any.
+func (r *Room) flushPresence() {
+	p := &r.presence
+	p.flushing.Lock()
+	defer p.flushing.Unlock()
+	p.mu.Lock()
+	update := &pb.RosterUpdate{Left: p.left}
+	// Marked under p.mu so that a leave racing with this flush is queued
+	// for the next one rather than lost.
+	for _, c := range p.joined {
+		update.Joined = append(update.Joined, c.participant())
+		c.announced.Store(true)
+	}
+	for _, c := range p.resumed {
+		update.Resumed = append(update.Resumed, c.participant())
+		c.announced.Store(true)
+	}
+	p.joined, p.resumed, p.left = nil, nil, nil
+	p.scheduled = false
+	p.mu.Unlock()
+	if len(update.Joined)+len(update.Resumed)+len(update.Left) == 0 {
+		return
+	}
+	r.Broadcast(&pb.ConferenceData{Sender: "Server", Payload: &pb.ConferenceData_Roster{Roster: update}}, nil)
+}
+
+func without(list []*Client, c *Client) []*Client {
+	for i, x := range list {
+		if x == c {
+			return append(list[:i], list[i+1:]...)
+		}
+	}
+	return list
+}
@@ -0,0 +1,179 @@
+package main
+
+import (
+	"crypto/hmac"
+	"crypto/rand"
+	"crypto/sha256"
+	"encoding/base64"
+	"encoding/json"
+	"errors"
+	"os"
+	sig "os/signal"
+	"strings"
+	"syscall"
+	"time"
+
+	"google.golang.org/grpc"
+	"google.golang.org/grpc/codes"
+	"google.golang.org/grpc/status"
+
+	pb "conference-server/conference"
+)
+
+// --- Session resumption and drain ---
+//
+// WELCOME hands every client a resume token: its room, name and participant
+// ID, an expiry, and an HMAC-SHA256 over them keyed with RESUME_SECRET. A
+// client that reconnects with the token in its JOIN resumes quietly: it keeps
+// its participant ID when that is still free, so nobody's ID table changes,
+// no join is announced, and if the old stream is still open it is closed
+// without announcing a leave. The missed messages come from the room history
+// as for any rejoin. Tokens verify on any process that shares RESUME_SECRET,
+// so they survive a restart and work across a cluster; without it a random
+// key is used and tokens only work until the process exits.
+//
+// On SIGTERM the server drains: it refuses new streams, sends every client a
+// RECONNECT command with a fresh token (and DRAIN_REDIRECT, if set, as the
+// address to reconnect to), and waits up to DRAIN_TIMEOUT seconds for them
+// to go before cutting off whoever is left. Departures during a drain are
+// not announced either. Clients reconnect with jittered backoff, so the
+// restarted server does not take all of them at once.
+
+var (
+	resumeTokenTTL = time.Duration(envInt("RESUME_TOKEN_TTL", 600)) * time.Second
+	drainTimeout   = time.Duration(envInt("DRAIN_TIMEOUT", 10)) * time.Second
+	resumeKey      = func() []byte {
+		if secret := os.Getenv("RESUME_SECRET"); secret != "" {
+			return []byte(secret)
+		}
+		key := make([]byte, 32)
+		if _, err := rand.Read(key); err != nil {
+			panic("resume key: " + err.Error())
+		}
+		return key
+	}()
+)
+
+// resumeClaim is what a resume token vouches for.
+type resumeClaim struct {
+	Room    string `json:"r"`
+	Name    string `json:"n"`
+	PID     uint32 `json:"p"`
+	Expires int64  `json:"e"` // unix seconds
+}
+
+var errBadResumeToken = errors.New("invalid resume token")
+
+func resumeMAC(payload string) string {
+	mac := hmac.New(sha256.New, resumeKey)
+	mac.Write([]byte(payload))
+	return base64.RawURLEncoding.EncodeToString(mac.Sum(nil))
+}
+
+// issueResumeToken returns a token that lets c resume its place in room.
+func issueResumeToken(room string, c *Client) string {
+	raw, err := json.Marshal(resumeClaim{Room: room, Name: c.id, PID: c.pid, Expires: time.Now().Add(resumeTokenTTL).Unix()})
+	if err != nil {
+		panic("encoding resume token: " + err.Error())
+	}
+	payload := base64.RawURLEncoding.EncodeToString(raw)
+	return payload + "." + resumeMAC(payload)
+}
+
+// verifyResumeToken checks token against the room and name of a JOIN.
+func verifyResumeToken(token, room, name string) (*resumeClaim, error) {
+	payload, mac, ok := strings.Cut(token, ".")
+	if !ok || !hmac.Equal([]byte(mac), []byte(resumeMAC(payload))) {
+		return nil, errBadResumeToken
+	}
+	raw, err := base64.RawURLEncoding.DecodeString(payload)
+	if err != nil {
+		return nil, errBadResumeToken
+	}
+	var claim resumeClaim
+	if err := json.Unmarshal(raw, &claim); err != nil {
+		return nil, errBadResumeToken
+	}
+	if claim.Room != room || claim.Name != name || time.Now().Unix() > claim.Expires {
+		return nil, errBadResumeToken
+	}
+	return &claim, nil
+}
+
+// kick ends c's JoinConference with err; it is the first reason that counts.
+func (c *Client) kick(err error) {
+	c.kickOnce.Do(func() {
+		c.kickErr = err
+		close(c.kicked)
+	})
+}
+
+// pidFree reports whether no client but except holds pid. Called with r.mu
+// held.
+func (r *Room) pidFree(pid uint32, except *Client) bool {
+	for _, c := range r.users {
+		if c != except && c.pid == pid {
+			return false
+		}
+	}
+	return true
+}
+
+// --- Drain ---
+
+// drainOnSignal waits for SIGTERM or an interrupt, drains s and stops gs.
+// GracefulStop waits for in-flight file transfers too; that is capped as well.
+func (s *server) drainOnSignal(gs *grpc.Server) {
+	signals := make(chan os.Signal, 1)
+	sig.Notify(signals, syscall.SIGTERM, os.Interrupt)
+	logger.Infof("Received %v, draining", <-signals)
+	s.drain(drainTimeout)
+	stopped := make(chan struct{})
+	go func() {
+		gs.GracefulStop()
+		close(stopped)
+	}()
+	select {
+	case <-stopped:
+	case <-time.After(5 * time.Second):
+		gs.Stop()
+	}
+}
+
+// drain stops new sessions, asks every client to reconnect and waits up to
+// timeout for them to leave before disconnecting the rest.
+func (s *server) drain(timeout time.Duration) {
+	s.draining.Store(true)
+	redirect := os.Getenv("DRAIN_REDIRECT")
+	asked := 0
+	s.eachClient(func(room *Room, c *Client) {
+		c.enqueue(serverFrame(&pb.ConferenceData{
+			Sender: "Server",
+			Payload: &pb.ConferenceData_Command{Command: &pb.Command{
+				Type: "RECONNECT", Value: redirect, ResumeToken: issueResumeToken(room.id, c),
+			}},
+		}))
+		asked++
+	})
+	logger.Infof("Draining: asked %d clients to reconnect, waiting up to %v", asked, timeout)
+	for deadline := time.Now().Add(timeout); time.Now().Before(deadline); time.Sleep(100 * time.Millisecond) {
+		left := 0
+		s.eachClient(func(*Room, *Client) { left++ })
+		if left == 0 {
+			return
+		}
+	}
+	s.eachClient(func(_ *Room, c *Client) {
+		c.kick(status.Error(codes.Unavailable, "server shutting down"))
+	})
+}
+
+func (s *server) eachClient(f func(room *Room, c *Client)) {
+	s.rooms.Range(func(_, v any) bool {
+		room := v.(*Room)
+		for _, c := range room.clients.snapshot().all {
+			f(room, c)
+		}
+		return true
+	})
+}
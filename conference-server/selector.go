@@ -0,0 +1,174 @@
+package main
+
+import (
+	"math"
+	"os"
+	"sort"
+	"strconv"
+	"sync"
+	"time"
+
+	pb "conference-server/conference"
+)
+
+// --- Active-speaker selective forwarding ---
+//
+// In select mode the room relays audio like a selective forwarding unit, but
+// only from the K loudest senders. Levels come from AudioChunk.audio_level
+// (set by the clients) or are measured here for PCM chunks that lack one, and
+// are smoothed per sender. The ranking is refreshed at most every
+// selectorInterval; the current speakers get a small bonus so the selection
+// does not flap between voices of similar loudness.
+//
+// Every listener should hear K voices other than their own, so K+1 senders
+// are ranked: the top K go to everyone, and the next one goes only to those
+// top K speakers, each of whom would otherwise hear just K-1 others.
+
+const (
+	selectorInterval = 100 * time.Millisecond
+	// A sender that has sent nothing for this long no longer competes.
+	selectorStale = 400 * time.Millisecond
+	// Smoothing factor for the per-sender level (per chunk).
+	selectorSmoothing = 0.3
+	// Level bonus (in 127-dBov units) for already selected speakers.
+	selectorHysteresis = 6
+)
+
+// selectorTopK is the number of voices each listener receives
+// (AUDIO_TOP_K, default 3).
+var selectorTopK = func() int {
+	if k, err := strconv.Atoi(os.Getenv("AUDIO_TOP_K")); err == nil && k > 0 {
+		return k
+	}
+	return 3
+}()
+
+type speakerState struct {
+	level    float64
+	lastSeen time.Time
+	rank     int // position in the last ranking, -1 if not ranked
+}
+
+type speakerSelector struct {
+	mu        sync.Mutex
+	k         int
+	speakers  map[*Client]*speakerState
+	ranked    []*Client // top k+1, loudest first
+	refreshed time.Time
+}
+
+func newSpeakerSelector(k int) *speakerSelector {
+	return &speakerSelector{k: k, speakers: make(map[*Client]*speakerState)}
+}
+
+// observe records a chunk's level and returns the sender's rank, or -1 when
+// the chunk should not be forwarded at all.
+func (s *speakerSelector) observe(c *Client, level uint32, now time.Time) int {
+	s.mu.Lock()
+	defer s.mu.Unlock()
+	st, ok := s.speakers[c]
+	if !ok {
+		st = &speakerState{rank: -1}
+		s.speakers[c] = st
+	}
+	st.level += (float64(level) - st.level) * selectorSmoothing
+	st.lastSeen = now
+	if now.Sub(s.refreshed) >= selectorInterval {
+		s.rerank(now)
+	}
+	return st.rank
+}
+
+func (s *speakerSelector) rerank(now time.Time) {
+	s.refreshed = now
+	type candidate struct {
+		c     *Client
+		score float64
+	}
+	candidates := make([]candidate, 0, len(s.speakers))
+	for c, st := range s.speakers {
+		score := st.level
+		if st.rank >= 0 && st.rank < s.k {
+			score += selectorHysteresis
+		}
+		st.rank = -1
+		if now.Sub(st.lastSeen) < selectorStale {
+			candidates = append(candidates, candidate{c, score})
+		}
+	}
+	sort.Slice(candidates, func(i, j int) bool { return candidates[i].score > candidates[j].score })
+	s.ranked = s.ranked[:0]
+	for i, cand := range candidates {
+		if i > s.k {
+			break
+		}
+		s.speakers[cand.c].rank = i
+		s.ranked = append(s.ranked, cand.c)
+	}
+}
+
+// topSpeakers returns the senders currently forwarded to everyone.
+func (s *speakerSelector) topSpeakers() []*Client {
+	s.mu.Lock()
+	defer s.mu.Unlock()
+	n := min(len(s.ranked), s.k)
+	return append([]*Client(nil), s.ranked[:n]...)
+}
+
+func (s *speakerSelector) remove(c *Client) {
+	s.mu.Lock()
+	defer s.mu.Unlock()
+	delete(s.speakers, c)
+	for i, r := range s.ranked {
+		if r == c {
+			s.ranked = append(s.ranked[:i:i], s.ranked[i+1:]...)
+			break
+		}
+	}
+}
+
+// forwardSelected relays an audio chunk according to the sender's rank.
+func (r *Room) forwardSelected(sel *speakerSelector, msg *pb.ConferenceData, sender *Client) {
+	chunk := msg.GetAudioChunk()
+	level := chunk.GetAudioLevel()
+	if level == 0 && chunk.GetCodec() == pb.AudioCodec_AUDIO_CODEC_PCM16 {
+		level = pcmLevel(chunk.GetData())
+	}
+	rank := sel.observe(sender, level, time.Now())
+	switch {
+	case rank < 0:
+		return
+	case rank < sel.k:
+		r.Broadcast(msg, sender)
+	default:
+		f, err := newFrame(msg)
+		if err != nil {
+			return
+		}
+		for _, listener := range sel.topSpeakers() {
+			if listener != sender {
+				listener.enqueue(f)
+			}
+		}
+	}
+}
+
+// pcmLevel measures a PCM16 frame on the audio_level scale: 127 minus the
+// attenuation in dBov, so louder is higher (0 for digital silence).
+func pcmLevel(pcm []byte) uint32 {
+	samples := len(pcm) / 2
+	if samples == 0 {
+		return 0
+	}
+	var sum float64
+	for i := 0; i+1 < len(pcm); i += 2 {
+		v := float64(int16(uint16(pcm[i]) | uint16(pcm[i+1])<<8))
+		sum += v * v
+	}
+	rms := math.Sqrt(sum / float64(samples))
+	if rms < 1 {
+		return 0
+	}
+	dbov := -20 * math.Log10(rms/32768)
+	return uint32(max(1, min(127, 127-dbov)))
+}
@@ -0,0 +1,187 @@
+package main
+
+import (
+	"os"
+	"strconv"
+	"strings"
+	"sync"
+	"sync/atomic"
+	"time"
+
+	"google.golang.org/grpc/codes"
+	"google.golang.org/grpc/status"
+
+	pb "conference-server/conference"
+)
+
+// --- Slow consumers ---
+//
+// Nothing that delivers to a client blocks: a frame either fits on its lane
+// or is dropped. SLOW_CLIENT_POLICY decides what gives way when a client's
+// reliable lane fills up:
+//   - drop-new (default): the frame that does not fit is dropped;
+//   - drop-oldest: the oldest queued frame is dropped to make room;
+//   - drop-class: a lagging client sheds by class. Audio stops once the
+//     lane is half full, chat and file announcements at three quarters,
+//     and commands, offers and private messages only when it is full;
+//   - audio-off: on the first drop the client stops receiving audio until
+//     its reliable lane has drained.
+//
+// Independently, SLOW_CLIENT_MAX_DROPS > 0 disconnects a client once that
+// many reliable frames were dropped for it. Clients learn about losses from
+// DROPPED commands (the count since the last one, at most one per second)
+// and about audio-off from AUDIO_SUSPENDED / AUDIO_RESUMED. Those are
+// written by the client's own sender goroutine, so they never need room on
+// the lane that is full.
+
+type slowPolicy int
+
+const (
+	slowDropNew slowPolicy = iota
+	slowDropOldest
+	slowDropClass
+	slowAudioOff
+)
+
+func (p slowPolicy) String() string {
+	switch p {
+	case slowDropOldest:
+		return "drop-oldest"
+	case slowDropClass:
+		return "drop-class"
+	case slowAudioOff:
+		return "audio-off"
+	}
+	return "drop-new"
+}
+
+func parseSlowPolicy(s string) (slowPolicy, bool) {
+	switch strings.ToLower(strings.TrimSpace(s)) {
+	case "drop-new", "":
+		return slowDropNew, true
+	case "drop-oldest":
+		return slowDropOldest, true
+	case "drop-class":
+		return slowDropClass, true
+	case "audio-off":
+		return slowAudioOff, true
+	}
+	return slowDropNew, false
+}
+
+var (
+	slowClientPolicy = func() slowPolicy {
+		p, ok := parseSlowPolicy(os.Getenv("SLOW_CLIENT_POLICY"))
+		if !ok {
+			logger.Warnf("Unknown SLOW_CLIENT_POLICY %q, using drop-new", os.Getenv("SLOW_CLIENT_POLICY"))
+		}
+		return p
+	}()
+	slowClientMaxDrops = uint64(max(envInt("SLOW_CLIENT_MAX_DROPS", 0), 0))
+)
+
+// dropNoticeInterval spaces DROPPED commands while a client stays behind.
+const dropNoticeInterval = time.Second
+
+// slowState tracks what a client lost. The atomics are shared with whoever
+// enqueues; the rest belongs to the sender goroutine.
+type slowState struct {
+	unreported atomic.Uint64 // reliable drops not yet told to the client
+	audioOff   atomic.Bool
+	evictOnce  sync.Once
+
+	lastNotice    time.Time
+	audioNotified bool
+}
+
+// isControl reports whether f is something a lagging client must still get
+// under drop-class: commands, file offers and answers, private messages.
+func isControl(f *frame) bool {
+	return f.kind != kindText && f.kind != kindFileAnnouncement
+}
+
+// shed reports whether the policy drops f before trying the lane.
+func (c *Client) shed(f *frame, audio bool) bool {
+	switch slowClientPolicy {
+	case slowDropClass:
+		depth, size := len(c.ch), cap(c.ch)
+		if audio {
+			return depth >= size/2
+		}
+		return depth >= size*3/4 && !isControl(f)
+	case slowAudioOff:
+		return audio && c.slow.audioOff.Load()
+	}
+	return false
+}
+
+// dropReliable accounts for a reliable frame lost for c and applies the
+// audio-off and disconnect policies.
+func (c *Client) dropReliable() {
+	c.dropped.add(1)
+	metrics.droppedReliable.add(1)
+	c.slow.unreported.Add(1)
+	if slowClientPolicy == slowAudioOff {
+		c.slow.audioOff.Store(true)
+	}
+	if slowClientMaxDrops > 0 && c.dropped.load() >= slowClientMaxDrops {
+		c.evict()
+	}
+}
+
+// evict disconnects c for being too slow.
+func (c *Client) evict() {
+	c.slow.evictOnce.Do(func() {
+		dropped := c.dropped.load()
+		metrics.evictedClients.add(1)
+		logger.Warnf("Disconnecting client '%s' (%s): %d messages dropped", c.id, c.addr, dropped)
+		c.kick(status.Errorf(codes.ResourceExhausted, "client too slow: %d messages dropped", dropped))
+	})
+}
+
+// reportSlow runs on the sender goroutine after each write and tells the
+// client about drops and audio-off transitions. It returns false if the
+// stream failed.
+func (c *Client) reportSlow() bool {
+	s := &c.slow
+	if s.audioOff.Load() {
+		switch {
+		case !s.audioNotified:
+			s.audioNotified = true
+			if !c.write(audioSuspendedNotice) {
+				return false
+			}
+		case len(c.ch) == 0:
+			// Caught up: audio resumes. A drop racing with this turns it
+			// off again and the next report says so.
+			s.audioOff.Store(false)
+			s.audioNotified = false
+			if !c.write(audioResumedNotice) {
+				return false
+			}
+		}
+	}
+	if s.unreported.Load() == 0 {
+		return true
+	}
+	// Report at most once per interval while behind, and once more as soon as
+	// the lane has drained so the final count is not held back.
+	if now := time.Now(); now.Sub(s.lastNotice) >= dropNoticeInterval || len(c.ch) == 0 {
+		s.lastNotice = now
+		return c.write(slowNotice("DROPPED", strconv.FormatUint(s.unreported.Swap(0), 10)))
+	}
+	return true
+}
+
+// Notices without a value are the same for everyone and encoded once.
+var (
+	audioSuspendedNotice = slowNotice("AUDIO_SUSPENDED", "")
+	audioResumedNotice   = slowNotice("AUDIO_RESUMED", "")
+)
+
+func slowNotice(kind, value string) *frame {
+	return serverFrame(&pb.ConferenceData{
+		Sender:  "Server",
+		Payload: &pb.ConferenceData_Command{Command: &pb.Command{Type: kind, Value: value}},
+	})
+}
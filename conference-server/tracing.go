@@ -0,0 +1,50 @@
+package main
+
+import (
+	"time"
+
+	"google.golang.org/protobuf/encoding/protowire"
+
+	pb "conference-server/conference"
+)
+
+// --- Latency tracing ---
+//
+// Messages that arrive with ConferenceData.trace set are stamped as they
+// cross the server: on receipt, just before the broadcast is encoded, and as
+// each copy is written to a recipient's stream. The first two go into the
+// shared encoding. The send stamp differs per recipient, so it is appended to
+// a copy of the bytes as a second occurrence of the trace field; protobuf
+// merges repeated occurrences of a message field, and the recipient decodes
+// a single TraceStamps carrying all four stamps. Untraced messages pay
+// nothing beyond a nil check.
+
+const (
+	traceField      protowire.Number = 10 // ConferenceData.trace
+	traceServerSend protowire.Number = 4  // TraceStamps.server_send_us
+)
+
+func stampReceived(msg *pb.ConferenceData) {
+	if t := msg.GetTrace(); t != nil {
+		t.ServerRecvUs = time.Now().UnixMicro()
+	}
+}
+
+func stampEnqueued(msg *pb.ConferenceData) {
+	if t := msg.GetTrace(); t != nil {
+		t.ServerEnqueueUs = time.Now().UnixMicro()
+	}
+}
+
+// withSendStamp returns a copy of f whose encoding also carries
+// server_send_us = now.
+func (f *frame) withSendStamp(now time.Time) *frame {
+	var stamp [1 + protowire.MaxVarintLen64]byte
+	inner := protowire.AppendTag(stamp[:0], traceServerSend, protowire.VarintType)
+	inner = protowire.AppendVarint(inner, uint64(now.UnixMicro()))
+	data := make([]byte, 0, len(f.data)+2+len(inner))
+	data = append(data, f.data...)
+	data = protowire.AppendTag(data, traceField, protowire.BytesType)
+	data = protowire.AppendBytes(data, inner)
+	return &frame{data: data, kind: f.kind}
+}
@@ -0,0 +1,112 @@
+package main
+
+import (
+	"google.golang.org/protobuf/encoding/protowire"
+)
+
+// --- Hand-encoded server frames ---
+//
+// The messages the server builds on hot paths are appended straight to their
+// wire form, as batches are, instead of being built as ConferenceData trees
+// and marshalled: a relayed private message, and every mixed audio frame,
+// cost one buffer and one frame. The parts that never change are encoded
+// once, and notices without a value are encoded once at startup (see
+// slowclients.go). Fields are written in whatever order is convenient;
+// protobuf decoders accept any.
+
+const (
+	fieldRoomID         protowire.Number = 1  // ConferenceData.room_id
+	fieldSender         protowire.Number = 2  // ConferenceData.sender
+	fieldAudioChunk     protowire.Number = 4  // ConferenceData.audio_chunk
+	fieldPrivateMessage protowire.Number = 7  // ConferenceData.private_message
+	fieldHeader         protowire.Number = 11 // ConferenceData.header
+
+	fieldHeaderParticipant protowire.Number = 1 // FrameHeader.participant_id
+	fieldHeaderSeq         protowire.Number = 2 // FrameHeader.seq
+
+	fieldAudioData    protowire.Number = 1 // AudioChunk.data
+	fieldAudioFrameMs protowire.Number = 3 // AudioChunk.frame_duration_ms
+
+	fieldPrivateContent   protowire.Number = 2 // PrivateMessage.content
+	fieldPrivateTimestamp protowire.Number = 3 // PrivateMessage.timestamp
+)
+
+// appendVarintField appends a varint field, skipping it when v is zero as
+// the generated code does.
+func appendVarintField(b []byte, num protowire.Number, v uint64) []byte {
+	if v == 0 {
+		return b
+	}
+	b = protowire.AppendTag(b, num, protowire.VarintType)
+	return protowire.AppendVarint(b, v)
+}
+
+func sizeVarintField(num protowire.Number, v uint64) int {
+	if v == 0 {
+		return 0
+	}
+	return protowire.SizeTag(num) + protowire.SizeVarint(v)
+}
+
+// appendHeader appends a FrameHeader carrying participant pid and seq.
+func appendHeader(b []byte, pid, seq uint32) []byte {
+	size := sizeVarintField(fieldHeaderParticipant, uint64(pid)) + sizeVarintField(fieldHeaderSeq, uint64(seq))
+	b = protowire.AppendTag(b, fieldHeader, protowire.BytesType)
+	b = protowire.AppendVarint(b, uint64(size))
+	b = appendVarintField(b, fieldHeaderParticipant, uint64(pid))
+	return appendVarintField(b, fieldHeaderSeq, uint64(seq))
+}
+
+func sizeHeader(pid, seq uint32) int {
+	return protowire.SizeTag(fieldHeader) + protowire.SizeBytes(sizeVarintField(fieldHeaderParticipant, uint64(pid))+sizeVarintField(fieldHeaderSeq, uint64(seq)))
+}
+
+// privateFrame encodes a private message from participant from, as delivered
+// to its recipient.
+func privateFrame(from uint32, content string, timestamp int64) *frame {
+	inner := protowire.SizeTag(fieldPrivateContent) + protowire.SizeBytes(len(content)) +
+		sizeVarintField(fieldPrivateTimestamp, uint64(timestamp))
+	data := make([]byte, 0, sizeHeader(from, 0)+protowire.SizeTag(fieldPrivateMessage)+protowire.SizeBytes(inner))
+	data = appendHeader(data, from, 0)
+	data = protowire.AppendTag(data, fieldPrivateMessage, protowire.BytesType)
+	data = protowire.AppendVarint(data, uint64(inner))
+	data = protowire.AppendTag(data, fieldPrivateContent, protowire.BytesType)
+	data = protowire.AppendString(data, content)
+	data = appendVarintField(data, fieldPrivateTimestamp, uint64(timestamp))
+	return &frame{data: data, kind: kindPrivateMessage}
+}
+
+// audioTemplate encodes PCM audio frames of a fixed size from one server
+// sender. The prefix, everything up to the samples, is built once; a frame is
+// the prefix, the samples written in place, and a short per-frame tail.
+type audioTemplate struct {
+	prefix  []byte
+	samples int // bytes of PCM per frame
+	frameMs uint32
+}
+
+func newAudioTemplate(roomID, sender string, samples int, frameMs uint32) *audioTemplate {
+	inner := protowire.SizeTag(fieldAudioData) + protowire.SizeBytes(samples) + sizeVarintField(fieldAudioFrameMs, uint64(frameMs))
+	var b []byte
+	b = protowire.AppendTag(b, fieldRoomID, protowire.BytesType)
+	b = protowire.AppendString(b, roomID)
+	b = protowire.AppendTag(b, fieldSender, protowire.BytesType)
+	b = protowire.AppendString(b, sender)
+	b = protowire.AppendTag(b, fieldAudioChunk, protowire.BytesType)
+	b = protowire.AppendVarint(b, uint64(inner))
+	b = protowire.AppendTag(b, fieldAudioData, protowire.BytesType)
+	b = protowire.AppendVarint(b, uint64(samples))
+	return &audioTemplate{prefix: b, samples: samples, frameMs: frameMs}
+}
+
+// frame returns a frame with sequence number seq and the slice of its
+// encoding where the samples go. The caller fills pcm before the frame is
+// shared.
+func (t *audioTemplate) frame(seq uint32) (f *frame, pcm []byte) {
+	data := make([]byte, len(t.prefix)+t.samples, len(t.prefix)+t.samples+sizeVarintField(fieldAudioFrameMs, uint64(t.frameMs))+sizeHeader(0, seq))
+	copy(data, t.prefix)
+	pcm = data[len(t.prefix):]
+	data = appendVarintField(data, fieldAudioFrameMs, uint64(t.frameMs))
+	data = appendHeader(data, 0, seq)
+	return &frame{data: data, kind: kindAudio}, pcm
+}
@@ -0,0 +1,101 @@
+package main
+
+import (
+	"strings"
+	"testing"
+
+	"google.golang.org/protobuf/proto"
+
+	pb "conference-server/conference"
+)
+
+// The frames built in wire.go must decode to exactly the message proto.Marshal
+// would have sent, including when the fields appendVarintField skips are zero.
+
+func TestPrivateFrame(t *testing.T) {
+	cases := []struct {
+		name      string
+		from      uint32
+		content   string
+		timestamp int64
+	}{
+		{"typical", 7, "hola, ¿cómo estás?", 1700000000},
+		{"large values", 1 << 31, strings.Repeat("ñ", 300), 1 << 40},
+		{"zero values", 0, "", 0},
+	}
+	for _, tc := range cases {
+		t.Run(tc.name, func(t *testing.T) {
+			f := privateFrame(tc.from, tc.content, tc.timestamp)
+			if f.kind != kindPrivateMessage {
+				t.Errorf("kind = %v, want %v", f.kind, kindPrivateMessage)
+			}
+			want := &pb.ConferenceData{
+				Header: &pb.FrameHeader{ParticipantId: tc.from},
+				Payload: &pb.ConferenceData_PrivateMessage{PrivateMessage: &pb.PrivateMessage{
+					Content: tc.content, Timestamp: tc.timestamp,
+				}},
+			}
+			checkDecodes(t, f.data, want)
+		})
+	}
+}
+
+func TestAudioTemplateFrame(t *testing.T) {
+	cases := []struct {
+		name    string
+		roomID  string
+		sender  string
+		samples int
+		frameMs uint32
+		seq     uint32
+	}{
+		{"typical", "sala", "Server", 1920, 20, 42},
+		{"multi-byte lengths", "una sala con un nombre largo", "Server", 5760, 60, 1 << 30},
+		{"zero values", "", "", 0, 0, 0},
+	}
+	for _, tc := range cases {
+		t.Run(tc.name, func(t *testing.T) {
+			tmpl := newAudioTemplate(tc.roomID, tc.sender, tc.samples, tc.frameMs)
+			f, pcm := tmpl.frame(tc.seq)
+			if f.kind != kindAudio {
+				t.Errorf("kind = %v, want %v", f.kind, kindAudio)
+			}
+			if len(pcm) != tc.samples {
+				t.Fatalf("len(pcm) = %d, want %d", len(pcm), tc.samples)
+			}
+			for i := range pcm {
+				pcm[i] = byte(i*7 + 1)
+			}
+			want := &pb.ConferenceData{
+				RoomId: tc.roomID,
+				Sender: tc.sender,
+				Header: &pb.FrameHeader{Seq: tc.seq},
+				Payload: &pb.ConferenceData_AudioChunk{AudioChunk: &pb.AudioChunk{
+					Data: append([]byte(nil), pcm...), FrameDurationMs: tc.frameMs,
+				}},
+			}
+			checkDecodes(t, f.data, want)
+
+			// Frames from one template must not share their buffers.
+			g, other := tmpl.frame(tc.seq + 1)
+			for i := range other {
+				other[i] = 0xff
+			}
+			checkDecodes(t, f.data, want)
+			want.Header.Seq = tc.seq + 1
+			want.GetAudioChunk().Data = other
+			checkDecodes(t, g.data, want)
+		})
+	}
+}
+
+func checkDecodes(t *testing.T, data []byte, want *pb.ConferenceData) {
+	t.Helper()
+	got := new(pb.ConferenceData)
+	if err := proto.Unmarshal(data, got); err != nil {
+		t.Fatalf("proto.Unmarshal: %v", err)
+	}
+	if !proto.Equal(got, want) {
+		t.Errorf("decoded %v, want %v", got, want)
+	}
+}
@@ -0,0 +1,63 @@
+#!/bin/bash
+
+# Mide cuánto tarda el cliente Java desde que se lanza hasta enviar su primer
+# mensaje: con el JAR, con el JAR y el archivo AppCDS, y con el binario nativo
+# (los que estén compilados). Necesita un servidor corriendo en HOST:PORT;
+# `make bench-java-startup` levanta uno.
+
+HOST="${HOST:-localhost}"
+PORT="${PORT:-50051}"
+RUNS="${RUNS:-20}"
+
+JAR_FILE="target/chat-client-1.0-SNAPSHOT-jar-with-dependencies.jar"
+CDS_ARCHIVE="target/chat-client.jsa"
+NATIVE_BIN="target/chat-client"
+
+cd "$(dirname "$0")"
+
+if [ ! -f "$JAR_FILE" ]; then
+    echo "❌ JAR no encontrado: $JAR_FILE"
+    echo "Ejecuta primero: make java-client-jar"
+    exit 1
+fi
+
+now_us() {
+    if [ -n "$EPOCHREALTIME" ]; then echo "${EPOCHREALTIME/./}"; else date +%s%6N; fi
+}
+
+run_jar() { java --enable-native-access=ALL-UNNAMED "$@" -jar "$JAR_FILE"; }
+run_cds() { java --enable-native-access=ALL-UNNAMED -XX:SharedArchiveFile="$CDS_ARCHIVE" -Xshare:on "$@" -jar "$JAR_FILE"; }
+run_native() { "$NATIVE_BIN" "$@"; }
+
+# Lanza una variante RUNS veces; cada cliente entra, saluda y se va.
+measure() {
+    local label="$1" runner="$2" samples=() i us
+    for ((i = 1; i <= RUNS; i++)); do
+        us=$("$runner" -Dconference.host="$HOST" -Dconference.port="$PORT" \
+                -Dconference.room=startup-bench -Dconference.name="startup-$$-$i" \
+                -Dconference.message=hola -Dconference.launchedAtUs="$(now_us)" \
+                2>&1 >/dev/null | sed -n 's/^first_message_us=//p')
+        if [ -z "$us" ]; then
+            echo "❌ $label: el cliente no llegó a enviar su mensaje (¿está el servidor en $HOST:$PORT?)"
+            return 1
+        fi
+        samples+=("$us")
+    done
+    printf '%s\n' "${samples[@]}" | sort -n | awk -v label="$label" '
+        { v[NR] = $1 }
+        END { printf "%-12s min %7.1f ms   mediana %7.1f ms   máx %7.1f ms   (%d corridas)\n",
+              label, v[1] / 1000, v[int((NR + 1) / 2)] / 1000, v[NR] / 1000, NR }'
+}
+
+echo "Tiempo hasta el primer mensaje ($RUNS corridas por variante, servidor $HOST:$PORT):"
+measure "jar" run_jar || exit 1
+if [ -f "$CDS_ARCHIVE" ]; then
+    measure "jar+appcds" run_cds || exit 1
+else
+    echo "jar+appcds   (sin $CDS_ARCHIVE; créalo con: make java-client-cds)"
+fi
+if [ -x "$NATIVE_BIN" ]; then
+    measure "nativo" run_native || exit 1
+else
+    echo "nativo       (sin $NATIVE_BIN; créalo con: make java-client-native)"
+fi
@@ -2,7 +2,10 @@
 
 # Script para ejecutar el cliente Java con los permisos necesarios
 
+cd "$(dirname "$0")"
+
 JAR_FILE="target/chat-client-1.0-SNAPSHOT-jar-with-dependencies.jar"
+CDS_ARCHIVE="target/chat-client.jsa"
 
 # Verificar que el JAR existe
 if [ ! -f "$JAR_FILE" ]; then
@@ -11,6 +14,14 @@ if [ ! -f "$JAR_FILE" ]; then
     exit 1
 fi
 
-# Ejecutar con los flags necesarios
-java --enable-native-access=ALL-UNNAMED \
+# Con el archivo AppCDS (make java-client-cds) las clases ya vienen cargadas;
+# si no corresponde a este JAR o a esta JVM, se ignora y se arranca en frío.
+SHARE_FLAGS=()
+if [ -f "$CDS_ARCHIVE" ]; then
+    SHARE_FLAGS=(-XX:SharedArchiveFile="$CDS_ARCHIVE" -Xshare:auto)
+fi
+
+# Ejecutar con los flags necesarios (JAVA_OPTS para -Dconference.* y otros)
+exec java --enable-native-access=ALL-UNNAMED \
+     "${SHARE_FLAGS[@]}" $JAVA_OPTS \
      -jar "$JAR_FILE"
@@ -1,19 +1,35 @@
 package com.conference.client;
 
 import com.conference.grpc.AudioChunk;
+import com.conference.grpc.AudioCodec;
 import com.conference.grpc.ConferenceData;
+import com.conference.grpc.FrameHeader;
 import com.google.protobuf.ByteString;
+import com.google.protobuf.UnsafeByteOperations;
 import io.grpc.stub.StreamObserver;
 
 import javax.sound.sampled.*;
-import java.time.Instant;
-import java.util.UUID;
+import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
+import java.util.ArrayList;
+import java.util.List;
 
 public class AudioStreamer {
 
+    static final int SAMPLE_RATE = OpusCodec.SAMPLE_RATE;
+    // Frame duration, configurable with -Dconference.audio.frameMs (Opus accepts 10, 20, 40 or 60)
+    static final int FRAME_MS = configuredFrameMs();
+    static final int FRAME_SAMPLES = SAMPLE_RATE * FRAME_MS / 1000;
+    static final int FRAME_BYTES = FRAME_SAMPLES * 2;
+    // Capture buffers in flight; 16 frames is 320 ms of audio at 20 ms
+    private static final int POOL_SIZE = 16;
+    // Silence suppression, disable with -Dconference.audio.vad=false
+    private static final boolean VAD_ENABLED = !"false".equalsIgnoreCase(System.getProperty("conference.audio.vad"));
+    // While silent, a comfort-noise marker goes out this often as a keepalive
+    private static final long SILENCE_MARKER_INTERVAL_NANOS = 500_000_000L;
+
     private final StreamObserver<ConferenceData> requestObserver;
-    private final String sender;
-    private final String roomId;
+    private final LatencyStats latencyStats;
 
     private AudioFormat audioFormat;
     private TargetDataLine microphone;
@@ -23,11 +39,38 @@ public class AudioStreamer {
     private volatile boolean speakersActive = false;
     private Thread micCaptureThread;
 
-    public AudioStreamer(StreamObserver<ConferenceData> requestObserver, String sender, String roomId) {
+    // Codec the room asked us to send with (see AUDIO_CODEC / WELCOME commands)
+    private volatile AudioCodec sendCodec = AudioCodec.AUDIO_CODEC_PCM16;
+    private volatile JitterBuffer jitterBuffer;
+
+    public AudioStreamer(StreamObserver<ConferenceData> requestObserver, LatencyStats latencyStats) {
         this.requestObserver = requestObserver;
-        this.sender = sender;
-        this.roomId = roomId;
-        this.audioFormat = new AudioFormat(44100, 16, 1, true, false); // 44.1kHz, 16bit, Mono, Signed, Little-endian
+        this.latencyStats = latencyStats;
+        this.audioFormat = new AudioFormat(SAMPLE_RATE, 16, 1, true, false); // 48kHz, 16bit, Mono, Signed, Little-endian
+    }
+
+    private static int configuredFrameMs() {
+        int ms = Integer.getInteger("conference.audio.frameMs", 20);
+        if (ms != 10 && ms != 20 && ms != 40 && ms != 60) {
+            System.err.println("conference.audio.frameMs inválido (" + ms + "), usando 20 ms");
+            ms = 20;
+        }
+        return ms;
+    }
+
+    /** Codecs this client can both encode and decode, best first. */
+    public static List<AudioCodec> supportedCodecs() {
+        List<AudioCodec> codecs = new ArrayList<>();
+        if (OpusCodec.isAvailable()) codecs.add(AudioCodec.AUDIO_CODEC_OPUS);
+        codecs.add(AudioCodec.AUDIO_CODEC_PCM16);
+        return codecs;
+    }
+
+    public void setSendCodec(AudioCodec codec) {
+        if (codec == AudioCodec.AUDIO_CODEC_OPUS && !OpusCodec.isAvailable()) {
+            codec = AudioCodec.AUDIO_CODEC_PCM16;
+        }
+        this.sendCodec = codec;
     }
 
     public void startAudio() {
@@ -45,36 +88,17 @@ public class AudioStreamer {
             // Init speakers
             DataLine.Info speakerInfo = new DataLine.Info(SourceDataLine.class, audioFormat);
             speakers = (SourceDataLine) AudioSystem.getLine(speakerInfo);
-            speakers.open(audioFormat);
+            speakers.open(audioFormat, JitterBuffer.LINE_BUFFER_BYTES);
             speakers.start();
+            jitterBuffer = new JitterBuffer(speakers, latencyStats);
+            jitterBuffer.start();
             
             audioActive = true;
             speakersActive = true;
             System.out.println("🎤 Micrófono y altavoces activados.");
 
-            // Start thread to capture and send audio
-            micCaptureThread = new Thread(() -> {
-                byte[] buffer = new byte[1024];
-                while (audioActive) {
-                    int bytesRead = microphone.read(buffer, 0, buffer.length);
-                    if (bytesRead > 0) {
-                        try {
-                            AudioChunk audioChunk = AudioChunk.newBuilder()
-                                    .setData(ByteString.copyFrom(buffer, 0, bytesRead))
-                                    .build();
-                            ConferenceData conferenceData = ConferenceData.newBuilder()
-                                    .setSender(sender)
-                                    .setRoomId(roomId)
-                                    .setAudioChunk(audioChunk)
-                                    .build();
-                            requestObserver.onNext(conferenceData);
-                        } catch (Exception e) {
-                            System.err.println("Error al enviar audio: " + e.getMessage());
-                            audioActive = false;
-                        }
-                    }
-                }
-            });
+            // Start thread to capture and send audio, one frame at a time
+            micCaptureThread = new Thread(this::captureLoop);
             micCaptureThread.setDaemon(true);
             micCaptureThread.start();
 
@@ -84,6 +108,85 @@ public class AudioStreamer {
         }
     }
 
+    /**
+     * Captures one frame per iteration and sends it without copying the audio:
+     * PCM is read straight into a pooled array and Opus packets are encoded into
+     * pooled direct buffers, and both are wrapped with
+     * {@link UnsafeByteOperations#unsafeWrap}. Slots are reused round-robin, so
+     * a slot is refilled only POOL_SIZE frames after it was sent, by which time
+     * gRPC has long serialized the message.
+     */
+    private void captureLoop() {
+        byte[][] pcmPool = new byte[POOL_SIZE][FRAME_BYTES];
+        ByteBuffer[] packetPool = new ByteBuffer[POOL_SIZE];
+        for (int i = 0; i < POOL_SIZE; i++) {
+            packetPool[i] = ByteBuffer.allocateDirect(OpusCodec.MAX_PACKET_BYTES);
+        }
+        ByteBuffer encodeInput = ByteBuffer.allocateDirect(FRAME_BYTES).order(ByteOrder.LITTLE_ENDIAN);
+        OpusCodec.Encoder encoder = null;
+
+        AudioChunk.Builder chunkBuilder = AudioChunk.newBuilder().setFrameDurationMs(FRAME_MS);
+        // The server knows who we are from the JOIN message; frames carry only the header.
+        FrameHeader.Builder header = FrameHeader.newBuilder();
+        ConferenceData.Builder dataBuilder = ConferenceData.newBuilder();
+        VoiceActivityDetector vad = new VoiceActivityDetector(FRAME_MS);
+        boolean talking = false;
+        long lastMarkerNanos = 0;
+        int sequence = 0;
+        int slot = 0;
+        try {
+            while (audioActive) {
+                byte[] pcm = pcmPool[slot];
+                int bytesRead = microphone.read(pcm, 0, pcm.length);
+                if (bytesRead <= 0) continue;
+                // The frame's first sample was captured one frame before read returned.
+                long captureUs = LatencyStats.nowMicros() - bytesRead / 2 * 1_000_000L / SAMPLE_RATE;
+
+                // The detector also measures the frame level sent to the server.
+                boolean speech = vad.isSpeech(pcm, bytesRead);
+                if (VAD_ENABLED && !speech) {
+                    // Suppressed frames still advance the sequence so it stays a timeline.
+                    long now = System.nanoTime();
+                    if (talking || now - lastMarkerNanos >= SILENCE_MARKER_INTERVAL_NANOS) {
+                        chunkBuilder.setData(ByteString.EMPTY).setCodec(sendCodec).setComfortNoise(true).setAudioLevel(0);
+                        header.setSeq(sequence).setTsUs(captureUs);
+                        requestObserver.onNext(dataBuilder.setHeader(header).setAudioChunk(chunkBuilder).build());
+                        lastMarkerNanos = now;
+                        talking = false;
+                    }
+                    sequence++;
+                    continue;
+                }
+                talking = true;
+
+                AudioCodec codec = sendCodec;
+                ByteString data;
+                if (codec == AudioCodec.AUDIO_CODEC_OPUS && bytesRead == FRAME_BYTES) {
+                    if (encoder == null) encoder = new OpusCodec.Encoder();
+                    encodeInput.clear();
+                    encodeInput.put(pcm, 0, bytesRead).flip();
+                    ByteBuffer packet = packetPool[slot];
+                    packet.clear();
+                    int len = encoder.encode(encodeInput.asShortBuffer(), FRAME_SAMPLES, packet);
+                    packet.position(0).limit(len);
+                    data = UnsafeByteOperations.unsafeWrap(packet);
+                } else {
+                    codec = AudioCodec.AUDIO_CODEC_PCM16;
+                    data = UnsafeByteOperations.unsafeWrap(pcm, 0, bytesRead);
+                }
+                chunkBuilder.setData(data).setCodec(codec).setComfortNoise(false).setAudioLevel(vad.audioLevel());
+                header.setSeq(sequence++).setTsUs(captureUs);
+                requestObserver.onNext(dataBuilder.setHeader(header).setAudioChunk(chunkBuilder).build());
+                slot = (slot + 1) % POOL_SIZE;
+            }
+        } catch (Exception e) {
+            System.err.println("Error al enviar audio: " + e.getMessage());
+            audioActive = false;
+        } finally {
+            if (encoder != null) encoder.close();
+        }
+    }
+
     public void stopAudio() {
         if (!audioActive) {
             return;
@@ -98,16 +201,26 @@ public class AudioStreamer {
             microphone.stop();
             microphone.close();
         }
+        if (jitterBuffer != null) {
+            jitterBuffer.stop();
+            jitterBuffer = null;
+        }
         if (speakers != null && speakers.isOpen()) {
             speakers.drain();
             speakers.close();
         }
         System.out.println("🎤 Micrófono y altavoces desactivados.");
     }
-    
-    public void playAudioChunk(byte[] audioData) {
-        if (speakersActive && speakers != null && speakers.isOpen()) {
-            speakers.write(audioData, 0, audioData.length);
+
+    /**
+     * Hands an audio frame from {@code from} to the jitter buffer. Decoding, mixing and
+     * the blocking speaker write all happen on the playout thread, so this is
+     * safe to call from the gRPC callback thread.
+     */
+    public void playAudioChunk(String from, ConferenceData data) {
+        JitterBuffer buffer = jitterBuffer;
+        if (speakersActive && buffer != null) {
+            buffer.enqueue(from, data);
         }
     }
 
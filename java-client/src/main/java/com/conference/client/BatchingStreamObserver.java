@@ -0,0 +1,135 @@
+package com.conference.client;
+
+import com.conference.grpc.ConferenceBatch;
+import com.conference.grpc.ConferenceData;
+import io.grpc.stub.StreamObserver;
+
+import java.util.ArrayList;
+import java.util.List;
+import java.util.concurrent.Executors;
+import java.util.concurrent.ScheduledExecutorService;
+import java.util.concurrent.TimeUnit;
+
+/**
+ * Serializes and coalesces what the client sends on its JoinConference stream.
+ *
+ * <p>Chat input, audio capture and file announcements send from their own
+ * threads, and a gRPC {@link StreamObserver} must not be called concurrently.
+ * Every message is queued here and written by a single sender thread.
+ * Whatever is queued when that thread gets to it goes out as one
+ * {@link ConferenceBatch}; a lone message is sent as is. With
+ * {@code -Dconference.batch.windowMs} above 0 the sender also waits that long
+ * after the first message for more, trading that much latency for fewer
+ * writes. Keep it well below the ~320 ms the audio capture pool lasts, since
+ * queued audio still points into pooled buffers until it is written.
+ *
+ * <p>Nothing is written until {@link #start} hands over the JOIN, which goes
+ * out first and on its own: the server reads it from the call's first
+ * message.
+ */
+final class BatchingStreamObserver implements StreamObserver<ConferenceData> {
+
+    private static final long WINDOW_MS = Long.getLong("conference.batch.windowMs", 0);
+    private static final int MAX_MESSAGES = 64;
+    private static final int MAX_BYTES = 64 * 1024;
+
+    private final StreamObserver<ConferenceData> delegate;
+    private final ScheduledExecutorService sender = Executors.newSingleThreadScheduledExecutor(r -> {
+        Thread t = new Thread(r, "conference-send");
+        t.setDaemon(true);
+        return t;
+    });
+    private List<ConferenceData> queue = new ArrayList<>(); // guarded by this
+    private boolean flushScheduled; // guarded by this
+    private boolean closed; // guarded by this
+    private boolean started; // guarded by this
+
+    BatchingStreamObserver(StreamObserver<ConferenceData> delegate) {
+        this.delegate = delegate;
+    }
+
+    @Override
+    public void onNext(ConferenceData data) {
+        synchronized (this) {
+            if (closed) throw new IllegalStateException("el stream ya está cerrado");
+            queue.add(data);
+            if (flushScheduled || !started) return;
+            flushScheduled = true;
+        }
+        sender.schedule(this::flush, WINDOW_MS, TimeUnit.MILLISECONDS);
+    }
+
+    /** Sends first alone, then whatever was queued before it, and from then on as usual. */
+    void start(ConferenceData first) {
+        synchronized (this) {
+            started = true;
+            flushScheduled = true;
+        }
+        sender.execute(() -> {
+            try {
+                delegate.onNext(first);
+            } catch (RuntimeException e) {
+                abandon();
+                return;
+            }
+            flush();
+        });
+    }
+
+    @Override
+    public void onError(Throwable t) {
+        synchronized (this) {
+            if (closed) return;
+            closed = true;
+            queue.clear();
+        }
+        sender.execute(() -> delegate.onError(t));
+        sender.shutdown();
+    }
+
+    @Override
+    public void onCompleted() {
+        synchronized (this) {
+            if (closed) return;
+            closed = true;
+        }
+        sender.execute(() -> {
+            flush();
+            delegate.onCompleted();
+        });
+        sender.shutdown();
+    }
+
+    /** Runs on the sender thread: writes everything queued so far. */
+    private void flush() {
+        List<ConferenceData> messages;
+        synchronized (this) {
+            messages = queue;
+            queue = new ArrayList<>();
+            flushScheduled = false;
+        }
+        int i = 0;
+        while (i < messages.size()) {
+            ConferenceBatch.Builder batch = ConferenceBatch.newBuilder();
+            int bytes = 0;
+            while (i < messages.size() && batch.getMessagesCount() < MAX_MESSAGES && bytes < MAX_BYTES) {
+                ConferenceData message = messages.get(i++);
+                bytes += message.getSerializedSize();
+                batch.addMessages(message);
+            }
+            try {
+                delegate.onNext(batch.getMessagesCount() == 1
+                        ? batch.getMessages(0) : ConferenceData.newBuilder().setBatch(batch).build());
+            } catch (RuntimeException e) {
+                abandon();
+                return;
+            }
+        }
+    }
+
+    /** The call is gone; the response observer reports why. */
+    private synchronized void abandon() {
+        closed = true;
+        queue.clear();
+    }
+}
@@ -3,17 +3,22 @@ package com.conference.client;
 import com.conference.grpc.*;
 import io.grpc.ManagedChannel;
 import io.grpc.ManagedChannelBuilder;
+import io.grpc.Status;
 import io.grpc.stub.StreamObserver;
 
 import java.time.Instant;
 import java.time.LocalDateTime;
 import java.time.ZoneId;
 import java.time.format.DateTimeFormatter;
+import java.util.ArrayList;
+import java.util.List;
+import java.util.Map;
 import java.util.Scanner;
 import java.util.UUID;
+import java.util.concurrent.ConcurrentHashMap;
 import java.util.concurrent.CountDownLatch;
+import java.util.concurrent.ThreadLocalRandom;
 import java.util.concurrent.TimeUnit;
-import java.util.concurrent.atomic.AtomicBoolean;
 
 public class ChatClient {
 
@@ -24,35 +29,85 @@ public class ChatClient {
         CONNECTION_ERROR
     }
 
-    private final ManagedChannel channel;
-    private final ConferenceServiceGrpc.ConferenceServiceStub asyncStub;
+    // Reconnection after the server asks for it (RECONNECT) or the stream drops
+    private static final int RECONNECT_MAX_ATTEMPTS = Integer.getInteger("conference.reconnect.maxAttempts", 8);
+    private static final long RECONNECT_BASE_MS = Long.getLong("conference.reconnect.baseMs", 500);
+    private static final long RECONNECT_MAX_MS = Long.getLong("conference.reconnect.maxMs", 15000);
+    // Scripted use (kiosks, bots): with -Dconference.room nothing is asked, and with
+    // -Dconference.message the client says that once it is in the room and leaves.
+    private static final String SCRIPTED_MESSAGE = System.getProperty("conference.message");
+
+    private ManagedChannel channel;
+    private ConferenceServiceGrpc.ConferenceServiceStub asyncStub;
     private String sender;
     private String roomId;
     private AudioStreamer audioStreamer;
     private FileTransferManager fileTransferManager;
-    private StreamObserver<ConferenceData> requestObserver;
+    private volatile StreamObserver<ConferenceData> requestObserver;
     private CountDownLatch finishLatch;
-    private SessionResult sessionResult;
+    private volatile SessionResult sessionResult;
+    // Lets us take our place back after a restart or a dropped connection
+    private volatile String resumeToken;
+    private volatile boolean welcomed;
+    private volatile boolean reconnect;
+    private volatile boolean userEnded;
+    private volatile String redirectTarget;
+    private final LatencyStats latencyStats = new LatencyStats();
+    // Everything shown while in a room goes through here, off the stream callbacks
+    private final ConsoleRenderer console = new ConsoleRenderer();
+    // Room-scoped participant IDs to names, from WELCOME and roster updates.
+    // IDs are never reused within a room, so departed names stay for replayed history.
+    private final Map<Integer, String> participants = new ConcurrentHashMap<>();
+    private volatile int selfId;
+    // Where we are in each room's history, so a rejoin only replays what we missed
+    private final Map<String, HistoryPosition> historyPositions = new ConcurrentHashMap<>();
+    private volatile HistoryPosition history;
+    // Messages up to this room_seq (from WELCOME) are history catch-up; their
+    // trace stamps say how long ago they were sent, not how fast they came.
+    private volatile long replayedUpTo;
+
+    private static final class HistoryPosition {
+        volatile long epoch;
+        volatile long seq;
+    }
 
 
     private static final DateTimeFormatter TIME_FORMATTER = DateTimeFormatter.ofPattern("HH:mm");
 
     public ChatClient(String host, int port) {
-        this.channel = ManagedChannelBuilder.forAddress(host, port)
+        connect(ManagedChannelBuilder.forAddress(host, port));
+    }
+
+    /**
+     * Callbacks run directly on the transport threads: every observer only
+     * updates state and hands off to a stage with its own thread (console,
+     * jitter buffer, file writer, sender), none of them blocks.
+     */
+    private void connect(ManagedChannelBuilder<?> builder) {
+        this.channel = builder
                 .usePlaintext()
                 .defaultLoadBalancingPolicy("pick_first")
+                .directExecutor()
                 .build();
+        // Connect now rather than on the JOIN, so the handshakes overlap with the prompts.
+        this.channel.getState(true);
         this.asyncStub = ConferenceServiceGrpc.newStub(channel);
     }
 
-    private synchronized void printMessage(String message) {
-        System.out.print("\r\u001b[2K");
-        System.out.println(message);
+    /** Moves to the server a RECONNECT pointed us at ("host:port"). */
+    private void switchServer(String target) {
+        ManagedChannel old = channel;
+        connect(ManagedChannelBuilder.forTarget(target));
+        old.shutdown();
+        printMessage("🔀 Cambiando al servidor " + target);
     }
 
-    private synchronized void printPrompt() {
-        System.out.print("[" + LocalDateTime.now().format(TIME_FORMATTER) + "] " + this.sender + ": ");
-        System.out.flush();
+    private void printMessage(String message) {
+        console.line(message);
+    }
+
+    private void printPrompt() {
+        console.raw("[" + LocalDateTime.now().format(TIME_FORMATTER) + "] " + this.sender + ": ");
     }
 
     public void shutdown() {
@@ -69,60 +124,210 @@ public class ChatClient {
         }
     }
 
+    /**
+     * Name of whoever sent {@code data}. Relayed frames carry only the
+     * sender's participant ID; server messages still name their sender.
+     */
+    private String senderOf(ConferenceData data) {
+        int id = data.getHeader().getParticipantId();
+        if (id == 0) return data.getSender();
+        String name = participants.get(id);
+        return name != null ? name : "#" + id;
+    }
+
+    private void updateParticipants(com.conference.grpc.Command cmd) {
+        for (Participant p : cmd.getParticipantsList()) {
+            participants.put(p.getId(), p.getName());
+            if (cmd.getType().equals("WELCOME") && p.getName().equals(sender)) selfId = p.getId();
+        }
+    }
+
+    /** Applies a roster diff and tells who came and went. */
+    private void handleRoster(RosterUpdate roster) {
+        List<String> joined = new ArrayList<>();
+        for (Participant p : roster.getJoinedList()) {
+            // Those we already know from WELCOME are not news.
+            if (participants.put(p.getId(), p.getName()) == null && p.getId() != selfId) joined.add(p.getName());
+        }
+        // Back under a new ID after a reconnect: not an arrival.
+        for (Participant p : roster.getResumedList()) participants.put(p.getId(), p.getName());
+        List<String> left = new ArrayList<>();
+        for (int id : roster.getLeftList()) {
+            String name = participants.get(id);
+            left.add(name != null ? name : "#" + id);
+        }
+        if (!joined.isEmpty()) {
+            printMessage("→ " + String.join(", ", joined) + (joined.size() == 1 ? " entró a la sala." : " entraron a la sala."));
+        }
+        if (!left.isEmpty()) {
+            printMessage("← " + String.join(", ", left) + (left.size() == 1 ? " salió de la sala." : " salieron de la sala."));
+        }
+    }
+
+    /**
+     * Tracks the room history sequence; returns false for a message we have
+     * already seen (sequenced messages arrive in order).
+     */
+    private boolean advanceHistory(ConferenceData data) {
+        long seq = data.getHeader().getRoomSeq();
+        if (seq == 0) return true;
+        HistoryPosition position = history;
+        if (seq <= position.seq) return false;
+        if (position.seq > 0 && seq > position.seq + 1) {
+            printMessage(String.format("⚠️ Faltan %d mensajes del historial de la sala.", seq - position.seq - 1));
+        }
+        position.seq = seq;
+        return true;
+    }
+
+    /** Full-jitter exponential backoff, so a restarted server is not hit by everyone at once. */
+    private static long reconnectDelay(int attempt) {
+        long ceiling = Math.min(RECONNECT_MAX_MS, RECONNECT_BASE_MS << Math.min(attempt, 20));
+        return ThreadLocalRandom.current().nextLong(ceiling + 1);
+    }
+
     public SessionResult startChat(String sender, String roomId) throws InterruptedException {
         this.sender = sender;
         this.roomId = roomId;
+        this.participants.clear();
+        this.selfId = 0;
+        this.history = historyPositions.computeIfAbsent(roomId, k -> new HistoryPosition());
+        this.resumeToken = null;
+        this.userEnded = false;
+        Thread inputThread = new Thread(this::handleUserInput);
+        int attempt = 0;
+        try {
+            while (true) {
+                runSession(inputThread);
+                if (userEnded || !reconnect) break;
+                if (welcomed) attempt = 0;
+                if (attempt >= RECONNECT_MAX_ATTEMPTS) {
+                    printMessage("❌ No se pudo reconectar tras " + attempt + " intentos.");
+                    break;
+                }
+                long delay = reconnectDelay(attempt++);
+                printMessage(String.format("🔄 Reconectando en %d ms (intento %d de %d)...", delay, attempt, RECONNECT_MAX_ATTEMPTS));
+                Thread.sleep(delay);
+                if (userEnded) break;
+            }
+        } finally {
+            inputThread.interrupt();
+            console.drain(1, TimeUnit.SECONDS); // before main() prints again
+        }
+        return this.sessionResult;
+    }
+
+    /** Runs one JoinConference stream until it ends. */
+    private void runSession(Thread inputThread) throws InterruptedException {
+        String target = redirectTarget;
+        if (target != null) {
+            redirectTarget = null;
+            switchServer(target);
+        }
         this.finishLatch = new CountDownLatch(1);
-        this.sessionResult = SessionResult.CONNECTION_ERROR; // Default to error
-        final AtomicBoolean connectionSuccessful = new AtomicBoolean(false);
+        if (!userEnded) this.sessionResult = SessionResult.CONNECTION_ERROR; // Default to error
+        this.welcomed = false;
+        this.reconnect = false;
 
         StreamObserver<ConferenceData> responseObserver = new StreamObserver<>() {
             @Override
             public void onNext(ConferenceData data) {
-                if (data.getSender().equals(ChatClient.this.sender) && data.getPayloadCase() != ConferenceData.PayloadCase.COMMAND) {
+                if (data.getPayloadCase() == ConferenceData.PayloadCase.BATCH) {
+                    for (ConferenceData message : data.getBatch().getMessagesList()) onNext(message);
+                    return;
+                }
+                if (!advanceHistory(data)) return;
+                if (data.getPayloadCase() != ConferenceData.PayloadCase.COMMAND && selfId != 0
+                        && data.getHeader().getParticipantId() == selfId) {
                     return;
                 }
+                final String from = senderOf(data);
 
                 final boolean shouldPrintPrompt = data.getPayloadCase() != ConferenceData.PayloadCase.AUDIO_CHUNK;
 
                 switch (data.getPayloadCase()) {
                     case TEXT_MESSAGE:
                         ChatMessage chat = data.getTextMessage();
-                        if (data.getSender().equals("Sistema-FileTransfer") && chat.getContent().startsWith("FILE_REQUEST:")) {
-                            handleP2PFileRequestNotification(chat.getContent());
-                        } else {
-                            LocalDateTime dt = LocalDateTime.ofInstant(Instant.ofEpochSecond(chat.getTimestamp()), ZoneId.systemDefault());
-                            String content = chat.getContent();
-                            
-                            if (content.startsWith("(private)")) {
-                                printMessage(String.format("[%s] %s", dt.format(TIME_FORMATTER), content));
-                            } else {
-                                printMessage(String.format("[%s] %s: %s", dt.format(TIME_FORMATTER), data.getSender(), content));
-                            }
+                        if (data.hasTrace() && data.getHeader().getRoomSeq() > replayedUpTo) {
+                            latencyStats.recordChat(from, data.getTrace(), LatencyStats.nowMicros());
                         }
+                        LocalDateTime dt = LocalDateTime.ofInstant(Instant.ofEpochSecond(chat.getTimestamp()), ZoneId.systemDefault());
+                        printMessage(String.format("[%s] %s: %s", dt.format(TIME_FORMATTER), from, chat.getContent()));
+                        break;
+                    case PRIVATE_MESSAGE:
+                        PrivateMessage pm = data.getPrivateMessage();
+                        LocalDateTime sent = LocalDateTime.ofInstant(Instant.ofEpochSecond(pm.getTimestamp()), ZoneId.systemDefault());
+                        printMessage(String.format("[%s] (privado de %s) %s", sent.format(TIME_FORMATTER), from, pm.getContent()));
+                        break;
+                    case ERROR:
+                        ServerError error = data.getError();
+                        printMessage(" Error del Servidor: " + error.getMessage());
+                        if (error.getFatal()) finishLatch.countDown();
+                        break;
+                    case FILE_OFFER:
+                        handleFileOffer(data.getFileOffer());
+                        break;
+                    case FILE_RESPONSE:
+                        fileTransferManager.handleFileResponse(data.getFileResponse());
                         break;
                     case FILE_ANNOUNCEMENT:
                         BroadcastFileAnnouncement announce = data.getFileAnnouncement();
                         String size = String.format("%.2f KiB", (double) announce.getFileSize() / 1024.0);
-                        printMessage(String.format("%s está compartiendo '%s' (%s).", data.getSender(), announce.getFilename(), size));
+                        printMessage(String.format("%s está compartiendo '%s' (%s).", from, announce.getFilename(), size));
                         printMessage(String.format("   Para descargar, usa: /download %s <ruta_destino>", announce.getTransferId()));
                         fileTransferManager.registerBroadcastTransfer(announce.getTransferId(), announce.getFileSize());
                         break;
+                    case ROSTER:
+                        handleRoster(data.getRoster());
+                        break;
                     case AUDIO_CHUNK:
                         if (audioStreamer != null && audioStreamer.isSpeakersActive()) {
-                            audioStreamer.playAudioChunk(data.getAudioChunk().getData().toByteArray());
+                            audioStreamer.playAudioChunk(from, data);
                         }
                         break;
                     case COMMAND:
                         com.conference.grpc.Command cmd = data.getCommand();
-                        if (cmd.getType().equals("ERROR")) {
-                            System.out.println("\r\u001b[2K Error del Servidor: " + cmd.getValue());
-                            finishLatch.countDown();
+                        updateParticipants(cmd);
+                        if (cmd.getType().equals("DROPPED")) {
+                            printMessage("⚠️ La conexión no da abasto: el servidor descartó " + cmd.getValue() + " mensajes para ti.");
+                        } else if (cmd.getType().equals("AUDIO_SUSPENDED")) {
+                            printMessage("⚠️ Conexión lenta: el servidor dejó de enviarte audio hasta que te pongas al día.");
+                        } else if (cmd.getType().equals("AUDIO_RESUMED")) {
+                            printMessage("🔊 El servidor volvió a enviarte audio.");
+                        } else if (cmd.getType().equals("AUDIO_CODEC")) {
+                            if (cmd.getAudioCodecsCount() > 0) audioStreamer.setSendCodec(cmd.getAudioCodecs(0));
+                            printMessage("[SERVER] Códec de audio de la sala: " + cmd.getValue());
+                        } else if (cmd.getType().equals("RECONNECT")) {
+                            // The server is going away: come back with the fresh token.
+                            if (!cmd.getResumeToken().isEmpty()) resumeToken = cmd.getResumeToken();
+                            if (!cmd.getValue().isEmpty()) redirectTarget = cmd.getValue();
+                            reconnect = true;
+                            printMessage("🔄 El servidor se está reiniciando; reconectando...");
+                            requestObserver.onCompleted();
                         } else if (cmd.getType().equals("WELCOME")) {
-                            connectionSuccessful.set(true);
-                            System.out.print("\r\u001b[2K");
-                            System.out.println("Conectado exitosamente como '" + sender + "' en sala '" + roomId + "'");
-                            System.out.println("Ya puedes chatear. Escribe /help para ver todos los comandos.");
+                            boolean resumed = resumeToken != null;
+                            if (!cmd.getResumeToken().isEmpty()) resumeToken = cmd.getResumeToken();
+                            replayedUpTo = cmd.getHistorySeq();
+                            if (cmd.getHistoryEpoch() != history.epoch) {
+                                // New room (or recreated since we left): our old position means nothing.
+                                history.epoch = cmd.getHistoryEpoch();
+                                history.seq = 0;
+                            }
+                            if (cmd.getAudioCodecsCount() > 0) audioStreamer.setSendCodec(cmd.getAudioCodecs(0));
+                            welcomed = true;
+                            if (resumed) {
+                                printMessage("Sesión reanudada como '" + sender + "' en sala '" + roomId + "'");
+                            } else {
+                                printMessage("Conectado exitosamente como '" + sender + "' en sala '" + roomId + "'");
+                                printMessage("Ya puedes chatear. Escribe /help para ver todos los comandos.");
+                            }
+                            if (SCRIPTED_MESSAGE != null && !resumed) {
+                                send(textMessage(SCRIPTED_MESSAGE));
+                                reportStartup();
+                                sessionResult = SessionResult.QUIT_APPLICATION;
+                                userEnded = true;
+                                requestObserver.onCompleted();
+                            }
                         } else {
                             printMessage(String.format("[SERVER] %s: %s", cmd.getType(), cmd.getValue()));
                         }
@@ -130,38 +335,73 @@ public class ChatClient {
                     default:
                         break;
                 }
-                if (connectionSuccessful.get() && shouldPrintPrompt) {
+                if (welcomed && shouldPrintPrompt && SCRIPTED_MESSAGE == null) {
                     printPrompt();
                 }
             }
-            @Override public void onError(Throwable t) { System.out.println("\r\u001b[2K Error en la conexión: " + t.getMessage()); finishLatch.countDown(); }
+            @Override public void onError(Throwable t) {
+                printMessage(" Error en la conexión: " + t.getMessage());
+                // Once we have been in the room, a lost stream is worth resuming, unless our
+                // session was taken over by another connection (ABORTED) or the name is taken.
+                Status.Code code = Status.fromThrowable(t).getCode();
+                if (resumeToken != null && code != Status.Code.ABORTED && code != Status.Code.ALREADY_EXISTS) reconnect = true;
+                finishLatch.countDown();
+            }
             @Override public void onCompleted() {
                 // If result is not already set to QUIT, it means it's a normal leave/disconnect.
                 if (sessionResult != SessionResult.QUIT_APPLICATION) {
                     sessionResult = SessionResult.NORMAL_LEAVE;
                 }
-                System.out.println("\r\u001b[2K🔌 Desconectado de la sala.");
+                printMessage("🔌 Desconectado de la sala.");
                 finishLatch.countDown();
             }
         };
 
-        requestObserver = asyncStub.joinConference(responseObserver);
-        this.audioStreamer = new AudioStreamer(requestObserver, sender, roomId);
-        this.fileTransferManager = new FileTransferManager(asyncStub, requestObserver, sender);
+        BatchingStreamObserver call = new BatchingStreamObserver(asyncStub.joinConference(responseObserver));
+        requestObserver = call;
+        this.audioStreamer = new AudioStreamer(requestObserver, latencyStats);
+        this.fileTransferManager = new FileTransferManager(asyncStub, requestObserver, sender, roomId, console);
 
         try {
-            ConferenceData joinMessage = ConferenceData.newBuilder().setSender(sender).setRoomId(roomId)
-                    .setCommand(com.conference.grpc.Command.newBuilder().setType("JOIN").build()).build();
-            requestObserver.onNext(joinMessage);
-            Thread inputThread = new Thread(this::handleUserInput);
-            inputThread.start();
+            com.conference.grpc.Command.Builder join = com.conference.grpc.Command.newBuilder().setType("JOIN")
+                    .addAllAudioCodecs(AudioStreamer.supportedCodecs()).setBatching(true)
+                    .setHistoryEpoch(history.epoch).setHistorySeq(history.seq);
+            if (resumeToken != null) join.setResumeToken(resumeToken);
+            // Whatever the input thread sent meanwhile waits until the JOIN is out.
+            call.start(ConferenceData.newBuilder().setSender(sender).setRoomId(roomId).setCommand(join).build());
+            if (SCRIPTED_MESSAGE == null && inputThread.getState() == Thread.State.NEW) inputThread.start();
             finishLatch.await();
-            inputThread.interrupt();
         } catch (RuntimeException e) {
             requestObserver.onError(e);
             throw e;
+        } finally {
+            if (audioStreamer.isAudioActive()) audioStreamer.stopAudio();
         }
-        return this.sessionResult;
+    }
+
+    /** Sends from the input thread, which outlives any one stream. */
+    private void send(ConferenceData data) {
+        try {
+            requestObserver.onNext(data);
+        } catch (IllegalStateException e) {
+            printMessage("⚠️ Sin conexión; mensaje no enviado.");
+        }
+    }
+
+    private static ConferenceData textMessage(String content) {
+        ChatMessage chat = ChatMessage.newBuilder().setContent(content)
+                .setTimestamp(Instant.now().getEpochSecond()).setTraceId(UUID.randomUUID().toString()).build();
+        return ConferenceData.newBuilder()
+                .setTextMessage(chat).setTrace(TraceStamps.newBuilder().setClientSendUs(LatencyStats.nowMicros())).build();
+    }
+
+    /**
+     * For the startup benchmark: microseconds from {@code -Dconference.launchedAtUs}
+     * (set by the launcher) until the first message was handed to the stream.
+     */
+    private static void reportStartup() {
+        long launchedUs = Long.getLong("conference.launchedAtUs", 0);
+        if (launchedUs > 0) System.err.println("first_message_us=" + (LatencyStats.nowMicros() - launchedUs));
     }
 
     private void handleUserInput() {
@@ -172,18 +412,14 @@ public class ChatClient {
                 if (scanner.hasNextLine()) {
                     String line = scanner.nextLine().trim();
                     if (line.isEmpty()) {
-                        System.out.print("\r\u001b[2K"); // Clear the line before re-printing prompt
+                        console.raw("\r\u001b[2K"); // Clear the line before re-printing prompt
                         printPrompt();
                         continue;
                     }
                     if (line.startsWith("/")) {
                         if (handleCommand(line)) break;
                     } else {
-                        ChatMessage chat = ChatMessage.newBuilder().setSender(this.sender).setContent(line).setRoomId(this.roomId)
-                                .setTimestamp(Instant.now().getEpochSecond()).setTraceId(UUID.randomUUID().toString()).build();
-                        ConferenceData data = ConferenceData.newBuilder().setSender(this.sender).setRoomId(this.roomId)
-                                .setTextMessage(chat).build();
-                        requestObserver.onNext(data);
+                        send(textMessage(line));
                         printPrompt();
                     }
                 } else { break; }
@@ -197,24 +433,27 @@ public class ChatClient {
         boolean shouldBreakLoop = false;
 
         switch (command) {
-            case "/help": printHelp(); printPrompt(); break;
+            case "/help": printMessage(helpText()); printPrompt(); break;
+            case "/stats": printMessage(latencyStats.report()); printPrompt(); break;
             case "/quit": case "/exit":
                 printMessage("Cerrando aplicación...");
                 this.sessionResult = SessionResult.QUIT_APPLICATION;
+                this.userEnded = true;
                 requestObserver.onCompleted();
                 shouldBreakLoop = true;
                 break;
             case "/leave":
                  printMessage("Saliendo de la sala...");
                  this.sessionResult = SessionResult.NORMAL_LEAVE;
+                 this.userEnded = true;
                  requestObserver.onCompleted();
                  shouldBreakLoop = true;
                  break;
             case "/msg":
                 if (parts.length >= 3) {
                     PrivateMessage pvtMsg = PrivateMessage.newBuilder().setRecipientId(parts[1]).setContent(parts[2]).build();
-                    ConferenceData data = ConferenceData.newBuilder().setSender(sender).setRoomId(roomId).setPrivateMessage(pvtMsg).build();
-                    requestObserver.onNext(data);
+                    ConferenceData data = ConferenceData.newBuilder().setPrivateMessage(pvtMsg).build();
+                    send(data);
                 } else { printMessage("Uso: /msg <usuario> <mensaje>"); }
                 printPrompt();
                 break;
@@ -233,6 +472,14 @@ public class ChatClient {
                 else printMessage("Uso: /mic <on|off>");
                 printPrompt();
                 break;
+            case "/audio-mode":
+                if (parts.length > 1 && parts[1].toLowerCase().matches("relay|mix|select")) {
+                    ConferenceData data = ConferenceData.newBuilder()
+                            .setCommand(com.conference.grpc.Command.newBuilder().setType("AUDIO_MODE").setValue(parts[1].toLowerCase()).build()).build();
+                    send(data);
+                } else printMessage("Uso: /audio-mode <relay|mix|select>");
+                printPrompt();
+                break;
             case "/upload":
                 if (parts.length == 3) fileTransferManager.uploadFile(parts[1], parts[2], roomId);
                 else printMessage("Uso: /upload <usuario> <ruta_archivo>");
@@ -260,22 +507,13 @@ public class ChatClient {
         }
     }
     
-    private void handleP2PFileRequestNotification(String message) {
-        String[] parts = message.split(":");
-        if (parts.length >= 6) {
-            String transferId = parts[1], fileSender = parts[2], filename = parts[3];
-            try {
-                long fileSize = Long.parseLong(parts[4]);
-                fileTransferManager.registerPendingP2PTransfer(transferId, fileSender, fileSize);
-                printMessage("\nSolicitud de archivo 1-a-1 recibida:");
-                printMessage("  De: " + fileSender);
-                printMessage("  Archivo: " + filename + " (" + fileSize + " bytes)");
-                printMessage("  Para aceptar: /accept " + transferId + " <ruta_destino>");
-                printMessage("  Para rechazar: /reject " + transferId);
-            } catch (NumberFormatException e) {
-                printMessage("Error: Formato de tamaño de archivo inválido en la notificación.");
-            }
-        }
+    private void handleFileOffer(FileOffer offer) {
+        fileTransferManager.registerPendingP2PTransfer(offer.getTransferId(), offer.getSender(), offer.getFileSize());
+        printMessage("\nSolicitud de archivo 1-a-1 recibida:");
+        printMessage("  De: " + offer.getSender());
+        printMessage("  Archivo: " + offer.getFilename() + " (" + offer.getFileSize() + " bytes)");
+        printMessage("  Para aceptar: /accept " + offer.getTransferId() + " <ruta_destino>");
+        printMessage("  Para rechazar: /reject " + offer.getTransferId() + " (expira en 60 s)");
     }
     
     private static void printWelcome() {
@@ -284,28 +522,51 @@ public class ChatClient {
         System.out.println("━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━\n");
     }
 
-    private static void printHelp() {
-        System.out.println("\n═══════════════════════════════════════════════════════");
-        System.out.println("                   COMANDOS DISPONIBLES");
-        System.out.println("═══════════════════════════════════════════════════════");
-        System.out.println("\n\uD83D\uDCDD Comandos de Chat y Sala:");
-        System.out.println("  /help                          - Mostrar esta ayuda");
-        System.out.println("  /msg <usuario> <mensaje>       - Enviar un mensaje privado");
-        System.out.println("  /leave                         - Salir de la sala actual para unirse a otra");
-        System.out.println("  /quit, /exit                   - Cerrar la aplicación");
-        System.out.println("\n\uD83C\uDFA4 Comandos de Audio:");
-        System.out.println("  /mic <on|off>                  - Activar o desactivar micrófono y altavoces");
-        System.out.println("\n\uD83D\uDCE4 Comandos de Archivos (1 a 1):");
-        System.out.println("  /upload <usuario> <archivo>    - Enviar un archivo a un usuario");
-        System.out.println("  /accept <id> <ruta>            - Aceptar transferencia");
-        System.out.println("  /reject <id>                   - Rechazar transferencia");
-        System.out.println("\n\uD83D\uDCE3 Comandos de Archivos (Sala Completa):");
-        System.out.println("  /upload-all <archivo>          - Compartir un archivo con la sala");
-        System.out.println("  /download <id> <ruta>          - Descargar un archivo compartido");
-        System.out.println("\n═══════════════════════════════════════════════════════\n");
+    private static String helpText() {
+        StringBuilder help = new StringBuilder();
+        help.append("\n═══════════════════════════════════════════════════════").append('\n');
+        help.append("                   COMANDOS DISPONIBLES").append('\n');
+        help.append("═══════════════════════════════════════════════════════").append('\n');
+        help.append("\n\uD83D\uDCDD Comandos de Chat y Sala:").append('\n');
+        help.append("  /help                          - Mostrar esta ayuda").append('\n');
+        help.append("  /msg <usuario> <mensaje>       - Enviar un mensaje privado").append('\n');
+        help.append("  /stats                         - Ver la latencia de chat y audio por participante").append('\n');
+        help.append("  /leave                         - Salir de la sala actual para unirse a otra").append('\n');
+        help.append("  /quit, /exit                   - Cerrar la aplicación").append('\n');
+        help.append("\n\uD83C\uDFA4 Comandos de Audio:").append('\n');
+        help.append("  /mic <on|off>                  - Activar o desactivar micrófono y altavoces").append('\n');
+        help.append("  /audio-mode <relay|mix|select> - Reenviar cada voz, mezclarlas o solo las más activas").append('\n');
+        help.append("\n\uD83D\uDCE4 Comandos de Archivos (1 a 1):").append('\n');
+        help.append("  /upload <usuario> <archivo>    - Enviar un archivo a un usuario").append('\n');
+        help.append("  /accept <id> <ruta>            - Aceptar transferencia").append('\n');
+        help.append("  /reject <id>                   - Rechazar transferencia").append('\n');
+        help.append("\n\uD83D\uDCE3 Comandos de Archivos (Sala Completa):").append('\n');
+        help.append("  /upload-all <archivo>          - Compartir un archivo con la sala").append('\n');
+        help.append("  /download <id> <ruta>          - Descargar un archivo compartido").append('\n');
+        help.append("\n═══════════════════════════════════════════════════════\n").append('\n');
+        return help.toString();
+    }
+
+    /** Joins -Dconference.room without asking anything; exits non-zero if that failed. */
+    private static int runScripted(String roomId) {
+        String host = System.getProperty("conference.host", "localhost");
+        int port = Integer.getInteger("conference.port", 50051);
+        String sender = System.getProperty("conference.name", "bot-" + ProcessHandle.current().pid());
+        ChatClient client = new ChatClient(host, port);
+        SessionResult result;
+        try {
+            result = client.startChat(sender, roomId);
+        } catch (InterruptedException e) {
+            result = SessionResult.CONNECTION_ERROR;
+        }
+        client.shutdown();
+        return result == SessionResult.CONNECTION_ERROR ? 1 : 0;
     }
 
     public static void main(String[] args) {
+        OpusCodec.preload(); // off the path to the JOIN, which lists the codecs we support
+        String scriptedRoom = System.getProperty("conference.room");
+        if (scriptedRoom != null) System.exit(runScripted(scriptedRoom));
         printWelcome();
         Scanner scanner = new Scanner(System.in);
         System.out.print("Dirección del servidor [localhost]: ");
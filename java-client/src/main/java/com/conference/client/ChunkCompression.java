@@ -0,0 +1,140 @@
+package com.conference.client;
+
+import com.conference.grpc.FileChunk;
+import com.conference.grpc.FileCompression;
+import com.google.protobuf.UnsafeByteOperations;
+import net.jpountz.lz4.LZ4Compressor;
+import net.jpountz.lz4.LZ4Factory;
+import net.jpountz.lz4.LZ4SafeDecompressor;
+
+import java.io.IOException;
+import java.nio.ByteBuffer;
+import java.util.ArrayList;
+import java.util.List;
+import java.util.zip.DataFormatException;
+import java.util.zip.Deflater;
+import java.util.zip.Inflater;
+
+/**
+ * Per-chunk compression for file transfers.
+ *
+ * <p>The sender picks a codec per transfer ({@code -Dconference.transfer.compression=lz4|deflate|none},
+ * LZ4 by default) among those the receiver accepts, and tags every chunk with
+ * the codec actually used. Chunks that do not shrink go out raw, so already
+ * compressed files cost one compression attempt per chunk and not a byte more
+ * on the wire.
+ */
+final class ChunkCompression {
+
+    /** Codecs this client can decompress. */
+    static final List<FileCompression> SUPPORTED = List.of(FileCompression.FILE_COMPRESSION_LZ4, FileCompression.FILE_COMPRESSION_DEFLATE);
+
+    private static final FileCompression PREFERRED = parse(System.getProperty("conference.transfer.compression", "lz4"));
+
+    private static final LZ4Factory LZ4 = LZ4Factory.fastestInstance();
+    private static final LZ4Compressor LZ4_COMPRESSOR = LZ4.fastCompressor();
+    private static final LZ4SafeDecompressor LZ4_DECOMPRESSOR = LZ4.safeDecompressor();
+    private static final ThreadLocal<Deflater> DEFLATERS = ThreadLocal.withInitial(() -> new Deflater(Deflater.BEST_SPEED));
+    private static final ThreadLocal<Inflater> INFLATERS = ThreadLocal.withInitial(Inflater::new);
+
+    private ChunkCompression() {}
+
+    private static FileCompression parse(String name) {
+        switch (name.toLowerCase()) {
+            case "deflate": return FileCompression.FILE_COMPRESSION_DEFLATE;
+            case "none": return FileCompression.FILE_COMPRESSION_NONE;
+            default: return FileCompression.FILE_COMPRESSION_LZ4;
+        }
+    }
+
+    /** Codec used for broadcasts, where nobody is asked first. */
+    static FileCompression preferred() {
+        return PREFERRED;
+    }
+
+    /** Codecs offered in a P2P request, preferred first; empty if compression is off. */
+    static List<FileCompression> offer() {
+        List<FileCompression> offer = new ArrayList<>();
+        if (PREFERRED == FileCompression.FILE_COMPRESSION_NONE) return offer;
+        offer.add(PREFERRED);
+        for (FileCompression codec : SUPPORTED) {
+            if (codec != PREFERRED) offer.add(codec);
+        }
+        return offer;
+    }
+
+    /** First codec of our offer that the receiver accepts, or NONE. */
+    static FileCompression choose(List<FileCompression> accepted) {
+        for (FileCompression codec : offer()) {
+            if (accepted.contains(codec)) return codec;
+        }
+        return FileCompression.FILE_COMPRESSION_NONE;
+    }
+
+    /**
+     * Sets the chunk's data from {@code src}, compressed with {@code codec}
+     * when that makes it smaller. Raw data is wrapped without copying.
+     */
+    static void compress(FileCompression codec, ByteBuffer src, FileChunk.Builder chunk) {
+        int raw = src.remaining();
+        chunk.setRawSize(raw);
+        if (raw > 0 && codec == FileCompression.FILE_COMPRESSION_LZ4) {
+            int max = LZ4_COMPRESSOR.maxCompressedLength(raw);
+            byte[] out = new byte[max];
+            int len = LZ4_COMPRESSOR.compress(src, src.position(), raw, ByteBuffer.wrap(out), 0, max);
+            if (len < raw) {
+                chunk.setData(UnsafeByteOperations.unsafeWrap(out, 0, len)).setCompression(codec);
+                return;
+            }
+        } else if (raw > 0 && codec == FileCompression.FILE_COMPRESSION_DEFLATE) {
+            Deflater deflater = DEFLATERS.get();
+            deflater.reset();
+            deflater.setInput(src.duplicate());
+            deflater.finish();
+            byte[] out = new byte[raw];
+            int len = deflater.deflate(out);
+            // Not finished within raw bytes means it did not shrink.
+            if (deflater.finished() && len < raw) {
+                chunk.setData(UnsafeByteOperations.unsafeWrap(out, 0, len)).setCompression(codec);
+                return;
+            }
+        }
+        chunk.setData(UnsafeByteOperations.unsafeWrap(src)).setCompression(FileCompression.FILE_COMPRESSION_NONE);
+    }
+
+    /**
+     * Decompresses a compressed chunk into {@code scratch} (grown if needed)
+     * and returns the buffer holding the raw bytes.
+     */
+    static ByteBuffer decompress(FileChunk chunk, ByteBuffer scratch) throws IOException {
+        int raw = chunk.getRawSize();
+        ByteBuffer out = scratch.capacity() >= raw ? scratch : ByteBuffer.allocateDirect(raw);
+        out.clear().limit(raw);
+        ByteBuffer src = chunk.getData().asReadOnlyByteBuffer();
+        switch (chunk.getCompression()) {
+            case FILE_COMPRESSION_LZ4: {
+                int len = LZ4_DECOMPRESSOR.decompress(src, src.position(), src.remaining(), out, 0, raw);
+                if (len != raw) throw new IOException("trozo LZ4 dañado");
+                out.position(0).limit(len);
+                return out;
+            }
+            case FILE_COMPRESSION_DEFLATE: {
+                Inflater inflater = INFLATERS.get();
+                inflater.reset();
+                inflater.setInput(src);
+                try {
+                    while (out.hasRemaining() && !inflater.finished()) {
+                        if (inflater.inflate(out) == 0 && (inflater.needsInput() || inflater.needsDictionary())) break;
+                    }
+                } catch (DataFormatException e) {
+                    throw new IOException("trozo Deflate dañado", e);
+                }
+                if (out.position() != raw) throw new IOException("trozo Deflate dañado");
+                out.flip();
+                return out;
+            }
+            default:
+                throw new IOException("compresión desconocida: " + chunk.getCompression());
+        }
+    }
+}
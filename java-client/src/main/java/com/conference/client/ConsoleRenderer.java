@@ -0,0 +1,76 @@
+package com.conference.client;
+
+import java.io.PrintStream;
+import java.util.concurrent.ArrayBlockingQueue;
+import java.util.concurrent.BlockingQueue;
+import java.util.concurrent.CountDownLatch;
+import java.util.concurrent.TimeUnit;
+import java.util.concurrent.atomic.AtomicLong;
+
+/**
+ * Writes the chat, notices, prompts and progress bars to the terminal from a
+ * single thread.
+ *
+ * <p>The channel runs its callbacks directly on the transport threads, which
+ * must never wait on a slow terminal. Callers hand over what to print and
+ * return at once; the queue is bounded ({@code -Dconference.render.queue},
+ * 4096 by default). Lines that do not fit are counted and reported once the
+ * terminal catches up; prompts and progress bars that do not fit are simply
+ * skipped, since a newer one follows.
+ */
+final class ConsoleRenderer {
+
+    private static final int CAPACITY = Math.max(16, Integer.getInteger("conference.render.queue", 4096));
+    private static final String CLEAR_LINE = "\r\u001b[2K";
+
+    private final PrintStream out = System.out;
+    private final BlockingQueue<Runnable> queue = new ArrayBlockingQueue<>(CAPACITY);
+    private final AtomicLong droppedLines = new AtomicLong();
+
+    ConsoleRenderer() {
+        Thread thread = new Thread(this::renderLoop, "conference-render");
+        thread.setDaemon(true);
+        thread.start();
+    }
+
+    /** Prints a line, replacing whatever prompt or progress bar is on the current one. */
+    void line(String text) {
+        if (!queue.offer(() -> {
+            out.print(CLEAR_LINE);
+            out.println(text);
+        })) {
+            droppedLines.incrementAndGet();
+        }
+    }
+
+    /** Prints text as is, without a newline: prompts and progress bars. */
+    void raw(String text) {
+        queue.offer(() -> {
+            out.print(text);
+            out.flush();
+        });
+    }
+
+    /** Waits up to the timeout for everything queued so far to be printed. */
+    void drain(long timeout, TimeUnit unit) throws InterruptedException {
+        CountDownLatch printed = new CountDownLatch(1);
+        if (queue.offer(printed::countDown)) printed.await(timeout, unit);
+    }
+
+    private void renderLoop() {
+        while (true) {
+            Runnable next;
+            try {
+                next = queue.take();
+            } catch (InterruptedException e) {
+                return;
+            }
+            long dropped = droppedLines.getAndSet(0);
+            if (dropped > 0) {
+                out.print(CLEAR_LINE);
+                out.println("⚠️ La terminal no da abasto: " + dropped + " líneas no se mostraron.");
+            }
+            next.run();
+        }
+    }
+}
@@ -2,26 +2,67 @@ package com.conference.client;
 
 import com.conference.grpc.*;
 import com.google.protobuf.ByteString;
+import com.google.protobuf.UnsafeByteOperations;
 import io.grpc.Metadata;
+import io.grpc.Status;
+import io.grpc.stub.ClientCallStreamObserver;
+import io.grpc.stub.ClientResponseObserver;
 import io.grpc.stub.MetadataUtils;
 import io.grpc.stub.StreamObserver;
 
-import java.io.FileOutputStream;
 import java.io.IOException;
-import java.io.InputStream;
+import java.nio.ByteBuffer;
+import java.nio.MappedByteBuffer;
+import java.nio.channels.FileChannel;
 import java.nio.file.Files;
 import java.nio.file.Path;
 import java.nio.file.Paths;
+import java.nio.file.StandardOpenOption;
 import java.time.Instant;
+import java.util.ArrayDeque;
+import java.util.ArrayList;
+import java.util.List;
 import java.util.UUID;
-import java.util.concurrent.atomic.AtomicBoolean;
-import java.util.concurrent.atomic.AtomicLong;
+import java.util.concurrent.CompletableFuture;
+import java.util.concurrent.ExecutionException;
+import java.util.concurrent.Executor;
+import java.util.concurrent.ExecutorService;
+import java.util.concurrent.Executors;
+import java.util.concurrent.ForkJoinPool;
+import java.util.concurrent.TimeUnit;
+import java.util.concurrent.TimeoutException;
 
 public class FileTransferManager {
     private final ConferenceServiceGrpc.ConferenceServiceStub asyncStub;
     private final StreamObserver<ConferenceData> requestObserver; // Observer for main channel
     private final String senderName;
+    private final String roomId; // routes TransferFile to the room's node in a cluster
+    private final ConsoleRenderer console;
     private static final int CHUNK_SIZE = 1024 * 64; // 64KB chunks
+    // Interrupted transfers resume from the server's chunk store
+    private static final int MAX_ATTEMPTS = 5;
+    private static final long RETRY_DELAY_MS = 1000;
+    private static final long ACK_TIMEOUT_SECONDS = 10;
+    // Large files go over several TransferFile streams, -Dconference.transfer.streams=N (1 disables it)
+    private static final int TRANSFER_STREAMS = Math.max(1, Integer.getInteger("conference.transfer.streams", 4));
+    private static final int MIN_CHUNKS_PER_STREAM = 64; // 4 MB
+    private static final long MAP_WINDOW_BYTES = 64L * 1024 * 1024;
+    private static final int PIPELINE_DEPTH = 4;
+    private static final Executor COMPRESSION_EXECUTOR = ForkJoinPool.commonPool();
+    private static final ExecutorService TRANSFER_EXECUTOR = Executors.newCachedThreadPool(r -> {
+        Thread t = new Thread(r, "file-transfer");
+        t.setDaemon(true);
+        return t;
+    });
+    // Downloads are written here, off the transport threads. A lane asks for
+    // at most WRITE_AHEAD chunks beyond what is on disk, so a slow disk slows
+    // the sender through flow control instead of piling chunks up in memory.
+    private static final int WRITE_AHEAD = 8;
+    private static final ExecutorService WRITE_EXECUTOR = Executors.newSingleThreadExecutor(r -> {
+        Thread t = new Thread(r, "file-write");
+        t.setDaemon(true);
+        return t;
+    });
     private static final java.time.format.DateTimeFormatter TIME_FORMATTER = java.time.format.DateTimeFormatter.ofPattern("HH:mm");
 
     private static class PendingTransfer {
@@ -33,27 +74,38 @@ public class FileTransferManager {
         }
     }
 
+    private static class PendingUpload {
+        final Path path;
+        final String recipient;
+        PendingUpload(Path path, String recipient) {
+            this.path = path;
+            this.recipient = recipient;
+        }
+    }
+
     // State for P2P and broadcast transfers
+    private final java.util.Map<String, PendingUpload> pendingUploads = new java.util.concurrent.ConcurrentHashMap<>();
     private final java.util.Map<String, PendingTransfer> pendingP2PTransfers = new java.util.concurrent.ConcurrentHashMap<>();
     private final java.util.Map<String, Long> pendingBroadcasts = new java.util.concurrent.ConcurrentHashMap<>();
 
 
-    public FileTransferManager(ConferenceServiceGrpc.ConferenceServiceStub asyncStub, StreamObserver<ConferenceData> requestObserver, String senderName) {
+    public FileTransferManager(ConferenceServiceGrpc.ConferenceServiceStub asyncStub, StreamObserver<ConferenceData> requestObserver,
+                               String senderName, String roomId, ConsoleRenderer console) {
         this.asyncStub = asyncStub;
         this.requestObserver = requestObserver;
         this.senderName = senderName;
+        this.roomId = roomId;
+        this.console = console;
     }
 
     // --- Message Printing ---
     private void printMessage(String message) {
-        System.out.print("\r\u001b[2K"); // Clear line
-        System.out.println(message);
+        console.line(message);
         printPrompt();
     }
 
     private void printPrompt() {
-        System.out.print("[" + java.time.LocalDateTime.now().format(TIME_FORMATTER) + "] Tú: ");
-        System.out.flush();
+        console.raw("[" + java.time.LocalDateTime.now().format(TIME_FORMATTER) + "] Tú: ");
     }
     
     // --- Broadcast File Logic ---
@@ -80,18 +132,17 @@ public class FileTransferManager {
                 .setFilename(filename)
                 .setFileSize(fileSize)
                 .setTransferId(transferId)
+                .setCompression(ChunkCompression.preferred())
                 .build();
             
             ConferenceData data = ConferenceData.newBuilder()
-                .setSender(senderName)
-                .setRoomId(roomId)
                 .setFileAnnouncement(announcement)
                 .build();
             
             requestObserver.onNext(data);
 
             // 2. Immediately start the sender stream
-            startFileStreamSender(path, transferId);
+            startFileStreamSender(path, transferId, ChunkCompression.preferred());
 
         } catch (IOException e) {
             printMessage("❌ Error al leer el archivo: " + e.getMessage());
@@ -128,20 +179,21 @@ public class FileTransferManager {
             FileTransferRequest request = FileTransferRequest.newBuilder()
                     .setSender(senderName).setRecipient(recipient).setRoomId(roomId)
                     .setFilename(filename).setFileSize(fileSize).setTransferId(transferId)
-                    .setTimestamp(Instant.now().getEpochSecond()).build();
+                    .setTimestamp(Instant.now().getEpochSecond())
+                    .addAllCompressions(ChunkCompression.offer()).build();
 
+            // The answer arrives later on the main stream (see handleFileResponse).
+            pendingUploads.put(transferId, new PendingUpload(path, recipient));
             asyncStub.requestFileTransfer(request, new StreamObserver<FileTransferResponse>() {
                 @Override
                 public void onNext(FileTransferResponse response) {
-                    if (response.getAccepted()) {
-                        printMessage("✅ " + recipient + " aceptó el archivo. Iniciando transferencia...");
-                        startFileStreamSender(path, transferId);
-                    } else {
-                        printMessage("⛔ " + recipient + " rechazó el archivo.");
-                    }
+                    if (response.getPending()) printMessage("📨 Solicitud enviada, esperando respuesta de " + recipient + "...");
                 }
                 @Override
-                public void onError(Throwable t) { printMessage("❌ Error en la solicitud de transferencia: " + t.getMessage()); }
+                public void onError(Throwable t) {
+                    pendingUploads.remove(transferId);
+                    printMessage("❌ Error en la solicitud de transferencia: " + t.getMessage());
+                }
                 @Override
                 public void onCompleted() {}
             });
@@ -150,6 +202,25 @@ public class FileTransferManager {
         }
     }
 
+    /**
+     * Handles the recipient's answer to one of our offers, pushed by the server
+     * on the main stream. The upload runs on the transfer pool so the stream's
+     * callback thread is never held up.
+     */
+    public void handleFileResponse(FileTransferResponse response) {
+        PendingUpload upload = pendingUploads.remove(response.getTransferId());
+        if (upload == null) return;
+        if (response.getAccepted()) {
+            printMessage("✅ " + upload.recipient + " aceptó el archivo. Iniciando transferencia...");
+            FileCompression compression = ChunkCompression.choose(response.getCompressionsList());
+            TRANSFER_EXECUTOR.execute(() -> startFileStreamSender(upload.path, response.getTransferId(), compression));
+        } else if (response.getExpired()) {
+            printMessage("⌛ " + upload.recipient + " no respondió a tiempo; la solicitud expiró.");
+        } else {
+            printMessage("⛔ " + upload.recipient + " rechazó el archivo.");
+        }
+    }
+
     public void acceptFile(String transferId, String savePath, String roomId) {
         PendingTransfer pending = pendingP2PTransfers.get(transferId);
         if (pending == null) {
@@ -159,7 +230,8 @@ public class FileTransferManager {
         printMessage("👍 Aceptando archivo " + transferId + " de " + pending.originalSender + "...");
         FileTransferResponse response = FileTransferResponse.newBuilder()
                 .setTransferId(transferId).setAccepted(true).setSender(senderName)
-                .setRecipient(pending.originalSender).setRoomId(roomId).build();
+                .setRecipient(pending.originalSender).setRoomId(roomId)
+                .addAllCompressions(ChunkCompression.SUPPORTED).build();
 
         asyncStub.respondFileTransfer(response, new StreamObserver<FileTransferResponse>() {
             @Override
@@ -169,7 +241,8 @@ public class FileTransferManager {
             @Override
             public void onCompleted() {
                 printMessage("📥 Conectando para recibir archivo...");
-                startFileStreamReceiver(transferId, savePath, pending.fileSize);
+                // Opening the file is disk I/O: not on the callback thread.
+                WRITE_EXECUTOR.execute(() -> startFileStreamReceiver(transferId, savePath, pending.fileSize));
                 pendingP2PTransfers.remove(transferId);
             }
         });
@@ -194,7 +267,7 @@ public class FileTransferManager {
 
     // --- Stream Workers (reused for P2P and broadcast) ---
 
-    private void updateProgress(String action, long current, long total) {
+    private synchronized void updateProgress(String action, long current, long total) {
         if (total <= 0) return;
         int percentage = (int) ((current * 100) / total);
         StringBuilder bar = new StringBuilder(60);
@@ -205,85 +278,371 @@ public class FileTransferManager {
             else bar.append(" ");
         }
         bar.append("]");
-        System.out.print(bar.toString());
-        System.out.flush();
+        console.raw(bar.toString());
     }
 
-    private void startFileStreamSender(Path path, String transferId) {
+    /**
+     * Chunk numbers of a transfer split into lanes, each sent (or received)
+     * over its own TransferFile stream. Chunk {@code n} holds the bytes at
+     * {@code n * CHUNK_SIZE}; the empty {@code is_last} chunk comes after the
+     * last data chunk and belongs to the last lane.
+     */
+    private static final class ChunkRange {
+        final int start, end; // end exclusive
+
+        ChunkRange(int start, int end) {
+            this.start = start;
+            this.end = end;
+        }
+
+        static int dataChunks(long fileSize) {
+            return (int) ((fileSize + CHUNK_SIZE - 1) / CHUNK_SIZE);
+        }
+
+        static List<ChunkRange> split(long fileSize) {
+            int data = dataChunks(fileSize);
+            int total = data + 1;
+            int lanes = Math.max(1, Math.min(TRANSFER_STREAMS, data / MIN_CHUNKS_PER_STREAM));
+            int perLane = (total + lanes - 1) / lanes;
+            List<ChunkRange> ranges = new ArrayList<>(lanes);
+            for (int start = 0; start < total; start += perLane) {
+                ranges.add(new ChunkRange(start, Math.min(total, start + perLane)));
+            }
+            return ranges;
+        }
+
+        long bytesBefore(int chunk, long fileSize) {
+            return Math.min(fileSize, (long) chunk * CHUNK_SIZE) - Math.min(fileSize, (long) start * CHUNK_SIZE);
+        }
+
+        /** Metadata value for the server, or null for a single-lane transfer. */
+        static String header(ChunkRange range, int lanes) {
+            return lanes == 1 ? null : range.start + "-" + range.end;
+        }
+    }
+
+    private void startFileStreamSender(Path path, String transferId, FileCompression compression) {
+        long fileSize;
+        try {
+            fileSize = Files.size(path);
+        } catch (IOException e) {
+            printMessage("❌ Error leyendo archivo local: " + e.getMessage());
+            return;
+        }
+        List<ChunkRange> ranges = ChunkRange.split(fileSize);
+        long[] laneProgress = new long[ranges.size()];
+        List<CompletableFuture<Boolean>> lanes = new ArrayList<>();
+        for (int lane = 0; lane < ranges.size(); lane++) {
+            int index = lane;
+            lanes.add(CompletableFuture.supplyAsync(
+                () -> sendLane(path, transferId, compression, ranges.get(index), ranges.size(), fileSize, laneProgress, index), TRANSFER_EXECUTOR));
+        }
+        boolean ok = lanes.stream().map(CompletableFuture::join).reduce(true, Boolean::logicalAnd);
+        if (ok) {
+            console.raw("\n");
+            printMessage("✅ Archivo enviado exitosamente.");
+        }
+    }
+
+    /** Sends one lane, retrying from the server's acknowledged position. */
+    private boolean sendLane(Path path, String transferId, FileCompression compression, ChunkRange range, int laneCount,
+                             long fileSize, long[] laneProgress, int lane) {
+        for (int attempt = 1; ; attempt++) {
+            try {
+                sendFrom(path, transferId, compression, range, laneCount, fileSize, laneProgress, lane);
+                return true;
+            } catch (IOException e) {
+                console.raw("\n");
+                printMessage("❌ Error leyendo archivo local: " + e.getMessage());
+                return false;
+            } catch (ExecutionException | TimeoutException e) {
+                Throwable cause = e instanceof ExecutionException ? e.getCause() : e;
+                console.raw("\n");
+                if (attempt == MAX_ATTEMPTS || !isRetryable(cause)) {
+                    printMessage("❌ Error durante el envío del archivo: " + cause.getMessage());
+                    return false;
+                }
+                printMessage("⚠️ Envío interrumpido, reintentando (" + attempt + "/" + (MAX_ATTEMPTS - 1) + ")...");
+                try {
+                    Thread.sleep(RETRY_DELAY_MS * attempt);
+                } catch (InterruptedException ie) {
+                    Thread.currentThread().interrupt();
+                    return false;
+                }
+            } catch (InterruptedException e) {
+                Thread.currentThread().interrupt();
+                return false;
+            }
+        }
+    }
+
+    /**
+     * One upload attempt for a lane. The server first answers with the chunk
+     * number it expects next within the lane (its start for a new transfer),
+     * so a retry only sends what the server does not have yet.
+     *
+     * <p>The lane maps the file in windows of {@link #MAP_WINDOW_BYTES}.
+     * Chunks are compressed on {@link #COMPRESSION_EXECUTOR} while earlier
+     * ones are sent; a chunk that goes out raw wraps a slice of the mapping
+     * without copying it, so the file must not change while it is being sent.
+     */
+    private void sendFrom(Path path, String transferId, FileCompression compression, ChunkRange range, int laneCount,
+                          long fileSize, long[] laneProgress, int lane)
+            throws IOException, ExecutionException, TimeoutException, InterruptedException {
         Metadata metadata = new Metadata();
         metadata.put(Metadata.Key.of("role", Metadata.ASCII_STRING_MARSHALLER), "sender");
         metadata.put(Metadata.Key.of("transfer-id", Metadata.ASCII_STRING_MARSHALLER), transferId);
+        metadata.put(Metadata.Key.of("room-id", Metadata.ASCII_STRING_MARSHALLER), roomId);
+        String header = ChunkRange.header(range, laneCount);
+        if (header != null) metadata.put(Metadata.Key.of("chunk-range", Metadata.ASCII_STRING_MARSHALLER), header);
         var stubWithMetadata = asyncStub.withInterceptors(MetadataUtils.newAttachHeadersInterceptor(metadata));
-        StreamObserver<FileChunk> requestObserver = stubWithMetadata.transferFile(new StreamObserver<>() {
-            @Override public void onNext(FileChunk v) {}
+
+        CompletableFuture<Integer> resumeAt = new CompletableFuture<>();
+        CompletableFuture<Void> done = new CompletableFuture<>();
+        Object readyLock = new Object();
+        StreamObserver<FileChunk> requestObserver = stubWithMetadata.transferFile(new ClientResponseObserver<FileChunk, FileChunk>() {
+            @Override public void beforeStart(ClientCallStreamObserver<FileChunk> call) {
+                call.setOnReadyHandler(() -> { synchronized (readyLock) { readyLock.notifyAll(); } });
+            }
+            @Override public void onNext(FileChunk ack) { resumeAt.complete(ack.getChunkNumber()); }
             @Override public void onError(Throwable t) {
-                System.out.println();
-                printMessage("❌ Error durante el envío del archivo: " + t.getMessage());
+                resumeAt.completeExceptionally(t);
+                done.completeExceptionally(t);
             }
             @Override public void onCompleted() {
-                System.out.println();
-                printMessage("✅ Archivo enviado exitosamente.");
+                resumeAt.complete(range.end);
+                done.complete(null);
             }
         });
-        try (InputStream stream = Files.newInputStream(path)) {
-            long fileSize = Files.size(path);
-            byte[] buffer = new byte[CHUNK_SIZE];
-            long totalBytesSent = 0;
-            int chunkNumber = 0, bytesRead;
-            while ((bytesRead = stream.read(buffer)) != -1) {
-                totalBytesSent += bytesRead;
-                requestObserver.onNext(FileChunk.newBuilder().setTransferId(transferId)
-                    .setData(ByteString.copyFrom(buffer, 0, bytesRead)).setChunkNumber(chunkNumber++).setIsLast(false).build());
-                updateProgress("Enviando", totalBytesSent, fileSize);
+        ClientCallStreamObserver<FileChunk> call = (ClientCallStreamObserver<FileChunk>) requestObserver;
+        int chunkNumber;
+        try {
+            chunkNumber = resumeAt.get(ACK_TIMEOUT_SECONDS, TimeUnit.SECONDS);
+        } catch (TimeoutException e) {
+            requestObserver.onError(Status.DEADLINE_EXCEEDED.withDescription("sin respuesta del servidor").asException());
+            throw e;
+        }
+        if (chunkNumber > range.start) printMessage("↪️ Reanudando envío desde el trozo " + chunkNumber + "...");
+
+        int lastChunk = ChunkRange.dataChunks(fileSize);
+        try (FileChannel channel = FileChannel.open(path, StandardOpenOption.READ)) {
+            if (channel.size() < fileSize) throw new IOException("el archivo cambió durante el envío");
+            MappedByteBuffer window = null;
+            long windowStart = 0;
+            // Up to PIPELINE_DEPTH chunks are mapped and compressed ahead of
+            // the one being sent.
+            ArrayDeque<CompletableFuture<FileChunk>> pipeline = new ArrayDeque<>();
+            int prepared = chunkNumber;
+            for (; chunkNumber < range.end && !done.isDone(); chunkNumber++) {
+                while (prepared < range.end && pipeline.size() < PIPELINE_DEPTH) {
+                    int n = prepared++;
+                    long offset = (long) n * CHUNK_SIZE;
+                    FileChunk.Builder chunk = FileChunk.newBuilder().setTransferId(transferId)
+                        .setChunkNumber(n).setOffset(offset);
+                    if (n == lastChunk) {
+                        pipeline.add(CompletableFuture.completedFuture(chunk.setData(ByteString.EMPTY).setIsLast(true).build()));
+                        continue;
+                    }
+                    int length = (int) Math.min(CHUNK_SIZE, fileSize - offset);
+                    if (window == null || offset + length > windowStart + window.capacity()) {
+                        windowStart = offset;
+                        window = channel.map(FileChannel.MapMode.READ_ONLY, offset, Math.min(MAP_WINDOW_BYTES, fileSize - offset));
+                    }
+                    ByteBuffer slice = window.duplicate();
+                    slice.position((int) (offset - windowStart)).limit((int) (offset - windowStart) + length);
+                    ByteBuffer data = slice.slice();
+                    pipeline.add(CompletableFuture.supplyAsync(() -> {
+                        ChunkCompression.compress(compression, data, chunk);
+                        return chunk.build();
+                    }, COMPRESSION_EXECUTOR));
+                }
+                FileChunk next = pipeline.poll().join();
+                // Respect HTTP/2 flow control instead of queueing the whole file in memory.
+                synchronized (readyLock) {
+                    while (!call.isReady() && !done.isDone()) readyLock.wait(100);
+                }
+                requestObserver.onNext(next);
+                updateLaneProgress("Enviando", laneProgress, lane, range.bytesBefore(chunkNumber + 1, fileSize), fileSize);
             }
-            requestObserver.onNext(FileChunk.newBuilder().setTransferId(transferId)
-                .setData(ByteString.EMPTY).setChunkNumber(chunkNumber).setIsLast(true).build());
-            requestObserver.onCompleted();
-        } catch (Exception e) {
-            System.out.println();
-            printMessage("❌ Error leyendo archivo local: " + e.getMessage());
-            requestObserver.onError(e);
+            if (!done.isDone()) requestObserver.onCompleted();
+        } catch (IOException e) {
+            requestObserver.onError(Status.CANCELLED.withDescription(e.getMessage()).asException());
+            throw e;
+        }
+        done.get();
+    }
+
+    private void updateLaneProgress(String action, long[] laneProgress, int lane, long laneBytes, long total) {
+        long sum = 0;
+        synchronized (laneProgress) {
+            laneProgress[lane] = laneBytes;
+            for (long bytes : laneProgress) sum += bytes;
+        }
+        updateProgress(action, sum, total);
+    }
+
+    /** Errors worth reconnecting for: the server refusing the transfer is not one of them. */
+    private static boolean isRetryable(Throwable t) {
+        switch (Status.fromThrowable(t).getCode()) {
+            case NOT_FOUND:
+            case INVALID_ARGUMENT:
+            case ALREADY_EXISTS:
+            case OUT_OF_RANGE:
+            case PERMISSION_DENIED:
+            case UNAUTHENTICATED:
+                return false;
+            default:
+                return true;
         }
     }
 
     private void startFileStreamReceiver(String transferId, String savePath, long fileSize) {
-        Metadata metadata = new Metadata();
-        metadata.put(Metadata.Key.of("role", Metadata.ASCII_STRING_MARSHALLER), "receiver");
-        metadata.put(Metadata.Key.of("transfer-id", Metadata.ASCII_STRING_MARSHALLER), transferId);
-        var stubWithMetadata = asyncStub.withInterceptors(MetadataUtils.newAttachHeadersInterceptor(metadata));
-        AtomicBoolean success = new AtomicBoolean(false);
-        AtomicLong totalBytesReceived = new AtomicLong(0);
-        stubWithMetadata.transferFile(new StreamObserver<>() {
-            FileOutputStream fileOutputStream = null;
-            @Override public void onNext(FileChunk chunk) {
-                try {
-                    if (fileOutputStream == null) fileOutputStream = new FileOutputStream(savePath);
-                    if (!chunk.getData().isEmpty()) {
-                        byte[] data = chunk.getData().toByteArray();
-                        fileOutputStream.write(data);
-                        updateProgress("Recibiendo", totalBytesReceived.addAndGet(data.length), fileSize);
+        FileChannel channel;
+        try {
+            channel = FileChannel.open(Paths.get(savePath), StandardOpenOption.CREATE,
+                StandardOpenOption.WRITE, StandardOpenOption.TRUNCATE_EXISTING);
+        } catch (IOException e) {
+            printMessage("❌ Error escribiendo archivo: " + e.getMessage());
+            return;
+        }
+        Download download = new Download(savePath, fileSize, channel, ChunkRange.split(fileSize));
+        for (int lane = 0; lane < download.ranges.size(); lane++) {
+            new ReceiveLane(transferId, download, lane).connect();
+        }
+    }
+
+    /** A download shared by its lanes: the output file and the overall result. */
+    private final class Download {
+        final String savePath;
+        final long fileSize;
+        final FileChannel channel;
+        final List<ChunkRange> ranges;
+        final long[] laneProgress;
+        private int lanesLeft;
+        private boolean success = true;
+        private boolean sawLast;
+
+        Download(String savePath, long fileSize, FileChannel channel, List<ChunkRange> ranges) {
+            this.savePath = savePath;
+            this.fileSize = fileSize;
+            this.channel = channel;
+            this.ranges = ranges;
+            this.laneProgress = new long[ranges.size()];
+            this.lanesLeft = ranges.size();
+        }
+
+        synchronized void laneFinished(boolean ok, boolean last) {
+            success &= ok;
+            sawLast |= last;
+            if (--lanesLeft > 0) return;
+            try { channel.close(); } catch (IOException e) { e.printStackTrace(); }
+            console.raw("\n");
+            if (success && sawLast) printMessage("✅ Archivo recibido y guardado en: " + savePath);
+            else if (success) printMessage("⚠️ Transferencia finalizada pero sin confirmación de éxito total.");
+        }
+    }
+
+    /**
+     * Receives one lane of a download with positional writes. Chunks are kept
+     * by the server, so after a failure the lane reconnects and asks for the
+     * next chunk it is missing ({@code resume-from}). Chunks, errors and
+     * completion are all handled on the write thread, in arrival order.
+     */
+    private final class ReceiveLane implements ClientResponseObserver<FileChunk, FileChunk> {
+        private final String transferId;
+        private final Download download;
+        private final int lane;
+        private final ChunkRange range;
+        private int nextChunk;
+        private boolean sawLast;
+        private boolean writeFailed;
+        private int attempts;
+        private ByteBuffer scratch; // decompression output, reused across chunks
+        private volatile ClientCallStreamObserver<FileChunk> call; // the current attempt
+
+        ReceiveLane(String transferId, Download download, int lane) {
+            this.transferId = transferId;
+            this.download = download;
+            this.lane = lane;
+            this.range = download.ranges.get(lane);
+            this.nextChunk = range.start;
+        }
+
+        synchronized void connect() {
+            attempts++;
+            Metadata metadata = new Metadata();
+            metadata.put(Metadata.Key.of("role", Metadata.ASCII_STRING_MARSHALLER), "receiver");
+            metadata.put(Metadata.Key.of("transfer-id", Metadata.ASCII_STRING_MARSHALLER), transferId);
+            metadata.put(Metadata.Key.of("room-id", Metadata.ASCII_STRING_MARSHALLER), roomId);
+            metadata.put(Metadata.Key.of("resume-from", Metadata.ASCII_STRING_MARSHALLER), Integer.toString(nextChunk));
+            String header = ChunkRange.header(range, download.ranges.size());
+            if (header != null) metadata.put(Metadata.Key.of("chunk-range", Metadata.ASCII_STRING_MARSHALLER), header);
+            asyncStub.withInterceptors(MetadataUtils.newAttachHeadersInterceptor(metadata)).transferFile(this);
+        }
+
+        @Override public void beforeStart(ClientCallStreamObserver<FileChunk> call) {
+            this.call = call;
+            call.disableAutoRequestWithInitial(WRITE_AHEAD);
+        }
+
+        @Override public void onNext(FileChunk chunk) {
+            ClientCallStreamObserver<FileChunk> from = call;
+            WRITE_EXECUTOR.execute(() -> {
+                if (write(chunk)) from.request(1);
+                else from.cancel("error escribiendo archivo", null);
+            });
+        }
+
+        @Override public void onError(Throwable t) {
+            WRITE_EXECUTOR.execute(() -> failed(t));
+        }
+
+        @Override public void onCompleted() {
+            WRITE_EXECUTOR.execute(() -> download.laneFinished(true, sawLast));
+        }
+
+        /** Writes one chunk; false if the file could not be written. */
+        private synchronized boolean write(FileChunk chunk) {
+            if (chunk.getChunkNumber() < nextChunk) return true; // already written before a reconnect
+            if (writeFailed) return false;
+            try {
+                long position = chunk.getOffset();
+                if (chunk.getCompression() != FileCompression.FILE_COMPRESSION_NONE) {
+                    if (scratch == null) scratch = ByteBuffer.allocateDirect(CHUNK_SIZE);
+                    ByteBuffer data = ChunkCompression.decompress(chunk, scratch);
+                    while (data.hasRemaining()) {
+                        position += download.channel.write(data, position);
+                    }
+                } else {
+                    // Write the chunk's own buffers; asReadOnlyByteBuffer()
+                    // would flatten a rope into a new array.
+                    for (ByteBuffer data : chunk.getData().asReadOnlyByteBufferList()) {
+                        while (data.hasRemaining()) {
+                            position += download.channel.write(data, position);
+                        }
                     }
-                    if (chunk.getIsLast()) success.set(true);
-                } catch (IOException e) {
-                    System.out.println();
-                    printMessage("❌ Error escribiendo archivo: " + e.getMessage());
-                    throw new RuntimeException(e);
                 }
+                nextChunk = chunk.getChunkNumber() + 1;
+                if (chunk.getIsLast()) sawLast = true;
+                updateLaneProgress("Recibiendo", download.laneProgress, lane, range.bytesBefore(nextChunk, download.fileSize), download.fileSize);
+                return true;
+            } catch (IOException e) {
+                writeFailed = true;
+                console.raw("\n");
+                printMessage("❌ Error escribiendo archivo: " + e.getMessage());
+                return false;
             }
-            @Override public void onError(Throwable t) {
-                System.out.println();
-                printMessage("❌ Error recibiendo archivo: " + t.getMessage());
-                closeFile();
-            }
-            @Override public void onCompleted() {
-                closeFile();
-                System.out.println();
-                if (success.get()) printMessage("✅ Archivo recibido y guardado en: " + savePath);
-                else printMessage("⚠️ Transferencia finalizada pero sin confirmación de éxito total.");
-            }
-            private void closeFile() {
-                if (fileOutputStream != null) try { fileOutputStream.close(); } catch (IOException e) { e.printStackTrace(); }
+        }
+
+        private synchronized void failed(Throwable t) {
+            console.raw("\n");
+            if (!sawLast && !writeFailed && attempts < MAX_ATTEMPTS && isRetryable(t)) {
+                printMessage("⚠️ Recepción interrumpida, reanudando desde el trozo " + nextChunk + "...");
+                CompletableFuture.delayedExecutor(RETRY_DELAY_MS * attempts, TimeUnit.MILLISECONDS).execute(this::connect);
+                return;
             }
-        });
+            printMessage("❌ Error recibiendo archivo: " + t.getMessage());
+            download.laneFinished(false, sawLast);
+        }
     }
 }
\ No newline at end of file
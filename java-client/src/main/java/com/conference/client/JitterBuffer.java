@@ -0,0 +1,283 @@
+package com.conference.client;
+
+import com.conference.grpc.AudioChunk;
+import com.conference.grpc.AudioCodec;
+import com.conference.grpc.ConferenceData;
+
+import javax.sound.sampled.SourceDataLine;
+import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
+import java.nio.ShortBuffer;
+import java.util.Arrays;
+import java.util.HashMap;
+import java.util.Iterator;
+import java.util.Map;
+import java.util.TreeMap;
+
+/**
+ * Adaptive jitter buffer and mixer for incoming audio.
+ *
+ * <p>The gRPC callback thread only calls {@link #enqueue}. A dedicated playout
+ * thread pulls 10 ms from every sender, mixes them with saturation and writes
+ * the result to the speakers; the blocking {@code write} on a short line buffer
+ * is what paces the loop.
+ *
+ * <p>Each sender has its own queue ordered by the sequence number in the frame
+ * header. Its target depth follows the RFC 3550 inter-arrival jitter estimate
+ * (one frame plus twice the jitter, between 20 and 200 ms). Missing frames are
+ * concealed with Opus PLC, or by fading out the last PCM frame, and a sender
+ * that runs dry buffers up again before resuming.
+ */
+final class JitterBuffer {
+
+    private static final int PLAYOUT_MS = 10;
+    private static final int PLAYOUT_SAMPLES = AudioStreamer.SAMPLE_RATE * PLAYOUT_MS / 1000;
+    /** Speaker line buffer: four playout periods (40 ms). */
+    static final int LINE_BUFFER_BYTES = PLAYOUT_SAMPLES * 2 * 4;
+
+    private static final int MIN_DEPTH_MS = 20;
+    private static final int MAX_DEPTH_MS = 200;
+    private static final int MAX_CONCEALED_FRAMES = 5;
+    /** A sequence this far behind the playout point means the sender restarted. */
+    private static final int RESTART_GAP = 50;
+    private static final long IDLE_TIMEOUT_NANOS = 5_000_000_000L;
+    /** Longest Opus packet (120 ms) plus a leftover partial frame. */
+    private static final int MAX_FRAME_SAMPLES = AudioStreamer.SAMPLE_RATE * 120 / 1000;
+
+    private final SourceDataLine speakers;
+    private final LatencyStats latencyStats;
+    private final Map<String, SenderStream> senders = new HashMap<>(); // guarded by this
+    private volatile boolean running;
+    private Thread playoutThread;
+
+    JitterBuffer(SourceDataLine speakers, LatencyStats latencyStats) {
+        this.speakers = speakers;
+        this.latencyStats = latencyStats;
+    }
+
+    void start() {
+        running = true;
+        playoutThread = new Thread(this::playoutLoop, "audio-playout");
+        playoutThread.setDaemon(true);
+        playoutThread.start();
+    }
+
+    void stop() {
+        running = false;
+        if (playoutThread != null) {
+            playoutThread.interrupt();
+            try {
+                playoutThread.join(500);
+            } catch (InterruptedException e) {
+                Thread.currentThread().interrupt();
+            }
+        }
+        synchronized (this) {
+            senders.values().forEach(SenderStream::close);
+            senders.clear();
+        }
+    }
+
+    /** Queues an audio frame from {@code from}; never blocks on audio output. */
+    synchronized void enqueue(String from, ConferenceData data) {
+        senders.computeIfAbsent(from, k -> new SenderStream(from)).add(data, System.nanoTime());
+    }
+
+    private void playoutLoop() {
+        int[] mix = new int[PLAYOUT_SAMPLES];
+        byte[] out = new byte[PLAYOUT_SAMPLES * 2];
+        while (running) {
+            Arrays.fill(mix, 0);
+            long now = System.nanoTime();
+            synchronized (this) {
+                Iterator<SenderStream> it = senders.values().iterator();
+                while (it.hasNext()) {
+                    SenderStream stream = it.next();
+                    if (now - stream.lastSeenNanos > IDLE_TIMEOUT_NANOS && !stream.hasAudio()) {
+                        stream.close();
+                        it.remove();
+                        continue;
+                    }
+                    stream.mixInto(mix);
+                }
+            }
+            for (int i = 0; i < PLAYOUT_SAMPLES; i++) {
+                int v = Math.max(Short.MIN_VALUE, Math.min(Short.MAX_VALUE, mix[i]));
+                out[2 * i] = (byte) v;
+                out[2 * i + 1] = (byte) (v >> 8);
+            }
+            if (!speakers.isOpen()) break;
+            speakers.write(out, 0, out.length);
+        }
+    }
+
+    /** Per-sender reorder queue, decoder and decoded-sample FIFO. */
+    private final class SenderStream {
+        private final String from;
+        private final TreeMap<Integer, ConferenceData> pending = new TreeMap<>();
+        private final short[] fifo = new short[MAX_FRAME_SAMPLES + PLAYOUT_SAMPLES];
+        private int fifoLen;
+
+        private final short[] lastFrame = new short[MAX_FRAME_SAMPLES];
+        private int lastFrameLen;
+        private int concealed;
+
+        private boolean playing;
+        private boolean draining;
+        private int nextSeq;
+        private int frameMs = AudioStreamer.FRAME_MS;
+
+        private double jitterMs;
+        private long lastArrivalNanos;
+        private int lastArrivalSeq;
+        long lastSeenNanos;
+
+        private OpusCodec.Decoder decoder;
+        private ByteBuffer decodeBuffer;
+
+        SenderStream(String from) {
+            this.from = from;
+        }
+
+        void add(ConferenceData data, long now) {
+            AudioChunk chunk = data.getAudioChunk();
+            int seq = data.getHeader().getSeq();
+            lastSeenNanos = now;
+            if (chunk.getComfortNoise()) {
+                // End of a talkspurt: the gap until the next one is silence, not
+                // loss or jitter, so neither conceal it nor measure it, and play
+                // out whatever is queued even if it is below the target depth.
+                lastArrivalNanos = 0;
+                draining = !pending.isEmpty();
+                return;
+            }
+            if (chunk.getFrameDurationMs() > 0) frameMs = chunk.getFrameDurationMs();
+            if (playing && seq < nextSeq - RESTART_GAP) {
+                // The sender restarted its sequence (e.g. /mic off and on again).
+                pending.clear();
+                playing = false;
+                lastArrivalNanos = 0;
+            }
+            if (lastArrivalNanos != 0) {
+                double delta = (now - lastArrivalNanos) / 1e6 - (double) (seq - lastArrivalSeq) * frameMs;
+                jitterMs += (Math.abs(delta) - jitterMs) / 16;
+            }
+            lastArrivalNanos = now;
+            lastArrivalSeq = seq;
+
+            if (playing && seq < nextSeq) return; // arrived after its slot was played or concealed
+            pending.put(seq, data);
+            while (pending.size() * frameMs > MAX_DEPTH_MS) {
+                int dropped = pending.pollFirstEntry().getKey();
+                if (playing && dropped >= nextSeq) nextSeq = dropped + 1;
+            }
+        }
+
+        private int targetDepthMs() {
+            int target = frameMs + (int) Math.ceil(2 * jitterMs);
+            return Math.max(MIN_DEPTH_MS, Math.min(MAX_DEPTH_MS, target));
+        }
+
+        boolean hasAudio() {
+            return fifoLen > 0 || !pending.isEmpty();
+        }
+
+        void mixInto(int[] mix) {
+            while (fifoLen < PLAYOUT_SAMPLES && refill()) {
+                // keep decoding until a full playout period is available
+            }
+            int n = Math.min(fifoLen, PLAYOUT_SAMPLES);
+            for (int i = 0; i < n; i++) {
+                mix[i] += fifo[i];
+            }
+            System.arraycopy(fifo, n, fifo, 0, fifoLen - n);
+            fifoLen -= n;
+        }
+
+        /** Appends the next frame (real or concealed) to the FIFO; false if none is due. */
+        private boolean refill() {
+            if (!playing) {
+                if (pending.isEmpty() || (!draining && pending.size() * frameMs < targetDepthMs())) return false;
+                playing = true;
+                nextSeq = pending.firstKey();
+            }
+            ConferenceData data = pending.remove(nextSeq);
+            if (data != null) {
+                decode(data);
+                concealed = 0;
+            } else if (pending.isEmpty()) {
+                // Underrun: stop and buffer up to the target depth again.
+                playing = false;
+                draining = false;
+                return false;
+            } else {
+                conceal();
+            }
+            nextSeq++;
+            return true;
+        }
+
+        private void decode(ConferenceData data) {
+            AudioChunk chunk = data.getAudioChunk();
+            long captureUs = data.getHeader().getTsUs();
+            if (captureUs > 0) {
+                // Ahead of this frame: what is still in the FIFO and the speaker line buffer.
+                long queuedUs = (fifoLen + LINE_BUFFER_BYTES / 2) * 1_000_000L / AudioStreamer.SAMPLE_RATE;
+                latencyStats.recordAudio(from, LatencyStats.nowMicros() - captureUs + queuedUs);
+            }
+            int samples;
+            if (chunk.getCodec() == AudioCodec.AUDIO_CODEC_OPUS) {
+                if (!OpusCodec.isAvailable()) return;
+                ShortBuffer pcm = opusOutput();
+                samples = decoder().decode(chunk.getData().toByteArray(), pcm, MAX_FRAME_SAMPLES);
+                pcm.get(lastFrame, 0, samples);
+            } else {
+                ByteBuffer pcm = chunk.getData().asReadOnlyByteBuffer().order(ByteOrder.LITTLE_ENDIAN);
+                samples = Math.min(pcm.remaining() / 2, MAX_FRAME_SAMPLES);
+                pcm.asShortBuffer().get(lastFrame, 0, samples);
+            }
+            lastFrameLen = samples;
+            append(lastFrame, samples);
+        }
+
+        private void conceal() {
+            if (++concealed > MAX_CONCEALED_FRAMES) {
+                lastFrameLen = frameMs * AudioStreamer.SAMPLE_RATE / 1000;
+                Arrays.fill(lastFrame, 0, lastFrameLen, (short) 0);
+            } else if (decoder != null) {
+                ShortBuffer pcm = opusOutput();
+                lastFrameLen = decoder.decode(null, pcm, frameMs * AudioStreamer.SAMPLE_RATE / 1000);
+                pcm.get(lastFrame, 0, lastFrameLen);
+            } else {
+                for (int i = 0; i < lastFrameLen; i++) lastFrame[i] = (short) (lastFrame[i] / 2);
+            }
+            append(lastFrame, lastFrameLen);
+        }
+
+        private void append(short[] samples, int count) {
+            count = Math.min(count, fifo.length - fifoLen);
+            System.arraycopy(samples, 0, fifo, fifoLen, count);
+            fifoLen += count;
+        }
+
+        private OpusCodec.Decoder decoder() {
+            if (decoder == null) decoder = new OpusCodec.Decoder();
+            return decoder;
+        }
+
+        private ShortBuffer opusOutput() {
+            if (decodeBuffer == null) {
+                decodeBuffer = ByteBuffer.allocateDirect(MAX_FRAME_SAMPLES * 2).order(ByteOrder.LITTLE_ENDIAN);
+            }
+            decodeBuffer.clear();
+            return decodeBuffer.asShortBuffer();
+        }
+
+        void close() {
+            if (decoder != null) {
+                decoder.close();
+                decoder = null;
+            }
+        }
+    }
+}
@@ -0,0 +1,123 @@
+package com.conference.client;
+
+import com.conference.grpc.TraceStamps;
+import io.opentelemetry.api.GlobalOpenTelemetry;
+import io.opentelemetry.api.common.AttributeKey;
+import io.opentelemetry.api.common.Attributes;
+import io.opentelemetry.api.metrics.DoubleHistogram;
+import io.opentelemetry.api.metrics.Meter;
+
+import java.time.Instant;
+import java.util.Map;
+import java.util.TreeMap;
+
+/**
+ * Per-participant latency of traced chat messages and of audio.
+ *
+ * <p>Chat messages carry the stamps in {@link TraceStamps}; on arrival the
+ * end-to-end time (sender's send stamp to now) and the time spent inside the
+ * server are recorded. Audio frames carry their capture time and are measured
+ * mouth to ear when the jitter buffer plays them out, including what is still
+ * queued in front of them and the speaker line buffer. Anything that compares
+ * two machines' clocks assumes they are synchronised (NTP); the server-side
+ * figure uses one clock only.
+ *
+ * <p>{@code /stats} prints the histograms. The same values are recorded on the
+ * OpenTelemetry API, which is a no-op unless the client runs with an
+ * OpenTelemetry agent or SDK that exports them.
+ */
+final class LatencyStats {
+
+    private static final AttributeKey<String> SENDER = AttributeKey.stringKey("sender");
+    private static final Meter METER = GlobalOpenTelemetry.getMeter("conference-client");
+    private static final DoubleHistogram CHAT_OTEL = METER.histogramBuilder("conference.chat.latency")
+            .setUnit("ms").setDescription("Chat message latency from the sender's send to display").build();
+    private static final DoubleHistogram CHAT_SERVER_OTEL = METER.histogramBuilder("conference.chat.server_latency")
+            .setUnit("ms").setDescription("Time a chat message spent inside the server").build();
+    private static final DoubleHistogram AUDIO_OTEL = METER.histogramBuilder("conference.audio.mouth_to_ear")
+            .setUnit("ms").setDescription("Audio latency from capture to the speaker").build();
+
+    private final Map<String, Histogram> chat = new TreeMap<>();
+    private final Map<String, Histogram> audio = new TreeMap<>();
+    private final Histogram chatServer = new Histogram();
+
+    static long nowMicros() {
+        Instant now = Instant.now();
+        return now.getEpochSecond() * 1_000_000L + now.getNano() / 1000;
+    }
+
+    /** Records a received chat message; {@code receivedUs} is our clock. */
+    void recordChat(String sender, TraceStamps trace, long receivedUs) {
+        long endToEnd = receivedUs - trace.getClientSendUs();
+        long inServer = trace.getServerSendUs() - trace.getServerRecvUs();
+        synchronized (this) {
+            chat.computeIfAbsent(sender, k -> new Histogram()).record(endToEnd);
+            if (trace.getServerRecvUs() > 0 && trace.getServerSendUs() > 0) chatServer.record(inServer);
+        }
+        Attributes attributes = Attributes.of(SENDER, sender);
+        CHAT_OTEL.record(endToEnd / 1000.0, attributes);
+        if (trace.getServerRecvUs() > 0 && trace.getServerSendUs() > 0) CHAT_SERVER_OTEL.record(inServer / 1000.0, attributes);
+    }
+
+    /** Records an audio frame that will reach the speaker {@code latencyUs} after capture. */
+    void recordAudio(String sender, long latencyUs) {
+        synchronized (this) {
+            audio.computeIfAbsent(sender, k -> new Histogram()).record(latencyUs);
+        }
+        AUDIO_OTEL.record(latencyUs / 1000.0, Attributes.of(SENDER, sender));
+    }
+
+    synchronized String report() {
+        StringBuilder out = new StringBuilder();
+        out.append(String.format("%n📊 Latencia (ms)                 %8s %8s %8s %8s%n", "n", "p50", "p99", "máx"));
+        for (Map.Entry<String, Histogram> e : chat.entrySet()) row(out, "chat de " + e.getKey(), e.getValue());
+        if (chatServer.count > 0) row(out, "chat dentro del servidor", chatServer);
+        for (Map.Entry<String, Histogram> e : audio.entrySet()) row(out, "audio boca-oído de " + e.getKey(), e.getValue());
+        if (chat.isEmpty() && audio.isEmpty()) out.append("  Sin mediciones todavía.\n");
+        return out.toString();
+    }
+
+    private static void row(StringBuilder out, String label, Histogram h) {
+        out.append(String.format("  %-30s %8d %8.1f %8.1f %8.1f%n", label, h.count,
+                h.quantile(0.50) / 1000.0, h.quantile(0.99) / 1000.0, h.max / 1000.0));
+    }
+
+    /**
+     * Log-linear histogram of microseconds: 16 buckets per power of two, so a
+     * quantile is within about 6%. Negative values (clock skew) count as 0.
+     */
+    private static final class Histogram {
+        private final long[] counts = new long[1024];
+        long count;
+        long max;
+
+        void record(long us) {
+            us = Math.max(0, us);
+            counts[bucketOf(us)]++;
+            count++;
+            max = Math.max(max, us);
+        }
+
+        long quantile(double q) {
+            long target = (long) (q * (count - 1)) + 1;
+            long seen = 0;
+            for (int i = 0; i < counts.length; i++) {
+                seen += counts[i];
+                if (seen >= target) return Math.min(valueOf(i), max);
+            }
+            return max;
+        }
+
+        private static int bucketOf(long us) {
+            if (us < 16) return (int) us;
+            int exp = 63 - Long.numberOfLeadingZeros(us);
+            return (exp - 3) * 16 + (int) ((us >>> (exp - 4)) & 15);
+        }
+
+        private static long valueOf(int bucket) {
+            if (bucket < 16) return bucket;
+            int exp = bucket / 16 + 3;
+            return (16L + bucket % 16) << (exp - 4);
+        }
+    }
+}
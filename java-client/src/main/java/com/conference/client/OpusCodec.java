@@ -0,0 +1,115 @@
+package com.conference.client;
+
+import club.minnced.opus.util.OpusLibrary;
+import com.sun.jna.ptr.PointerByReference;
+import tomp3.opus.Opus;
+
+import java.nio.ByteBuffer;
+import java.nio.IntBuffer;
+import java.nio.ShortBuffer;
+
+/**
+ * Thin wrapper around libopus (via opus-java) for 48 kHz mono voice.
+ * Encoders and decoders are stateful, so each outgoing stream gets one encoder
+ * and each remote sender gets its own decoder.
+ */
+final class OpusCodec {
+
+    static final int SAMPLE_RATE = 48000;
+    static final int CHANNELS = 1;
+    static final int MAX_PACKET_BYTES = 4000;
+
+    private static volatile Boolean available;
+
+    private OpusCodec() {}
+
+    /** Starts loading the native library in the background; {@link #isAvailable} waits for it. */
+    static void preload() {
+        Thread loader = new Thread(OpusCodec::isAvailable, "opus-load");
+        loader.setDaemon(true);
+        loader.start();
+    }
+
+    /** Loads the bundled native library once; PCM is used when this returns false. */
+    static boolean isAvailable() {
+        if (available == null) {
+            synchronized (OpusCodec.class) {
+                if (available == null) {
+                    boolean loaded;
+                    try {
+                        loaded = OpusLibrary.isInitialized() || OpusLibrary.loadFromJar();
+                    } catch (Throwable t) {
+                        System.err.println("Opus no disponible, se usará PCM: " + t.getMessage());
+                        loaded = false;
+                    }
+                    available = loaded;
+                }
+            }
+        }
+        return available;
+    }
+
+    static final class Encoder implements AutoCloseable {
+        private PointerByReference state;
+
+        Encoder() {
+            IntBuffer error = IntBuffer.allocate(1);
+            state = Opus.INSTANCE.opus_encoder_create(SAMPLE_RATE, CHANNELS, Opus.OPUS_APPLICATION_VOIP, error);
+            if (error.get(0) != Opus.OPUS_OK || state == null) {
+                throw new IllegalStateException("opus_encoder_create falló: " + error.get(0));
+            }
+        }
+
+        /**
+         * Encodes one frame of native-order PCM held in a direct buffer and
+         * returns the packet length written to {@code out}.
+         */
+        int encode(ShortBuffer pcm, int frameSamples, ByteBuffer out) {
+            int len = Opus.INSTANCE.opus_encode(state, pcm, frameSamples, out, out.capacity());
+            if (len < 0) {
+                throw new IllegalStateException("opus_encode falló: " + len);
+            }
+            return len;
+        }
+
+        @Override
+        public void close() {
+            if (state != null) {
+                Opus.INSTANCE.opus_encoder_destroy(state);
+                state = null;
+            }
+        }
+    }
+
+    static final class Decoder implements AutoCloseable {
+        private PointerByReference state;
+
+        Decoder() {
+            IntBuffer error = IntBuffer.allocate(1);
+            state = Opus.INSTANCE.opus_decoder_create(SAMPLE_RATE, CHANNELS, error);
+            if (error.get(0) != Opus.OPUS_OK || state == null) {
+                throw new IllegalStateException("opus_decoder_create falló: " + error.get(0));
+            }
+        }
+
+        /**
+         * Decodes a packet into {@code pcm} and returns the number of samples.
+         * A null packet asks libopus to conceal a lost frame.
+         */
+        int decode(byte[] packet, ShortBuffer pcm, int frameSamples) {
+            int samples = Opus.INSTANCE.opus_decode(state, packet, packet == null ? 0 : packet.length, pcm, frameSamples, 0);
+            if (samples < 0) {
+                throw new IllegalStateException("opus_decode falló: " + samples);
+            }
+            return samples;
+        }
+
+        @Override
+        public void close() {
+            if (state != null) {
+                Opus.INSTANCE.opus_decoder_destroy(state);
+                state = null;
+            }
+        }
+    }
+}
@@ -0,0 +1,85 @@
+package com.conference.client;
+
+/**
+ * Energy and zero-crossing-rate voice activity detector for 16-bit
+ * little-endian mono PCM frames.
+ *
+ * <p>The noise floor adapts during silence. A frame counts as speech when its
+ * energy is clearly above the floor and its zero-crossing rate is not that of
+ * broadband hiss, or when it is loud enough that the ZCR no longer matters. A
+ * hangover keeps the detector open for a few hundred milliseconds after speech
+ * so word endings and short pauses are not clipped.
+ *
+ * <p>The energy of the last frame is also reported as a level, which the
+ * server uses to pick the active speakers. The scale is this project's own:
+ * 127 minus the attenuation in dBov, so louder is higher. RFC 6464 uses the
+ * attenuation itself.
+ */
+final class VoiceActivityDetector {
+
+    /** Speech must be this many times the noise floor energy (~6 dB). */
+    private static final double ENERGY_RATIO = 4.0;
+    /** Above this ratio a frame is speech regardless of its ZCR. */
+    private static final double LOUD_RATIO = 20.0;
+    /** Fraction of sample pairs that change sign; hiss sits well above voiced speech. */
+    private static final double MAX_SPEECH_ZCR = 0.35;
+    /** Ignore anything quieter than roughly -60 dBFS. */
+    private static final double MIN_ENERGY = 1000.0;
+    private static final double FLOOR_ADAPT = 0.05;
+    private static final int HANGOVER_MS = 300;
+    private static final double FULL_SCALE_ENERGY = 32768.0 * 32768.0;
+
+    private final int hangoverFrames;
+    private double noiseFloor = MIN_ENERGY;
+    private double lastEnergy;
+    private int hangover;
+
+    VoiceActivityDetector(int frameMs) {
+        this.hangoverFrames = Math.max(1, HANGOVER_MS / frameMs);
+    }
+
+    /** Returns true if the frame should be sent. */
+    boolean isSpeech(byte[] pcm, int length) {
+        int samples = length / 2;
+        if (samples == 0) {
+            lastEnergy = 0;
+            return false;
+        }
+
+        // Single pass over the frame; both reductions are simple enough for
+        // the JIT to unroll and vectorise.
+        long sumSquares = 0;
+        int crossings = 0;
+        int previous = 0;
+        for (int i = 0; i < samples; i++) {
+            int sample = (short) ((pcm[2 * i] & 0xff) | (pcm[2 * i + 1] << 8));
+            sumSquares += (long) sample * sample;
+            crossings += ((sample ^ previous) >>> 31);
+            previous = sample;
+        }
+        double energy = (double) sumSquares / samples;
+        lastEnergy = energy;
+        double zcr = (double) crossings / samples;
+
+        boolean speech = energy > MIN_ENERGY
+                && (energy > noiseFloor * LOUD_RATIO
+                    || (energy > noiseFloor * ENERGY_RATIO && zcr < MAX_SPEECH_ZCR));
+        if (speech) {
+            hangover = hangoverFrames;
+            return true;
+        }
+        noiseFloor = Math.max(MIN_ENERGY, noiseFloor + (energy - noiseFloor) * FLOOR_ADAPT);
+        if (hangover > 0) {
+            hangover--;
+            return true;
+        }
+        return false;
+    }
+
+    /** Level of the last frame as 127 - dBov: 1 is near silence, 127 full scale, 0 digital silence. */
+    int audioLevel() {
+        if (lastEnergy < 1) return 0;
+        double dbov = 10 * Math.log10(lastEnergy / FULL_SCALE_ENERGY);
+        return (int) Math.max(1, Math.min(127, Math.round(127 + dbov)));
+    }
+}